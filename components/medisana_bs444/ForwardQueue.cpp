@@ -0,0 +1,38 @@
+#include "ForwardQueue.h"
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    void ForwardQueue::push(uint8_t person, uint8_t size, const Measurement &measurement)
+    {
+      if (count_ == CAPACITY)
+      {
+        // the newest measurements matter most
+        this->pop();
+        dropped_++;
+      }
+      entries_[(head_ + count_) % CAPACITY] = Entry{.person = person, .size = size, .measurement = measurement};
+      count_++;
+    }
+
+    bool ForwardQueue::contains(uint8_t person, uint32_t timestamp) const
+    {
+      for (uint8_t i = 0; i < count_; i++)
+      {
+        const auto &entry = entries_[(head_ + i) % CAPACITY];
+        if ((entry.person == person) && (entry.measurement.timestamp == timestamp))
+          return true;
+      }
+      return false;
+    }
+
+    void ForwardQueue::pop()
+    {
+      if (count_ == 0)
+        return;
+      head_ = (head_ + 1) % CAPACITY;
+      count_--;
+    }
+  } // namespace medisana_bs444
+} // namespace esphome
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "History.h"
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    // Measurements waiting for Home Assistant to connect, oldest first. When
+    // full the oldest one is dropped. Trivially copyable, to keep it in flash.
+    class ForwardQueue
+    {
+    public:
+      static constexpr size_t CAPACITY = 32;
+
+      struct Entry
+      {
+        uint8_t person = 0;
+        uint8_t size = 0; // cm, for the BMI, 0 if not known
+        Measurement measurement;
+      };
+
+      void push(uint8_t person, uint8_t size, const Measurement &measurement);
+      const Entry &front() const { return entries_[head_]; }
+      void pop();
+      bool contains(uint8_t person, uint32_t timestamp) const;
+
+      bool empty() const { return count_ == 0; }
+      size_t size() const { return count_; }
+      // since the queue was created
+      uint32_t dropped() const { return dropped_; }
+
+    private:
+      std::array<Entry, CAPACITY> entries_;
+      uint8_t head_ = 0;
+      uint8_t count_ = 0;
+      uint32_t dropped_ = 0;
+    };
+  } // namespace medisana_bs444
+} // namespace esphome
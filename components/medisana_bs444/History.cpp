@@ -0,0 +1,87 @@
+#include <cstdio>
+#include <cstring>
+
+#include "History.h"
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    const char *Measurement::format(char *buffer, size_t size, TimeFormatter &time) const
+    {
+      int len = snprintf(buffer, size, "Time:%s", time.format(timestamp));
+      if (has_weight() && len >= 0 && static_cast<size_t>(len) < size)
+        len += snprintf(buffer + len, size - len, "; weight: %u.%02u", weight / WEIGHT_SCALE, weight % WEIGHT_SCALE);
+      if (has_body() && len >= 0 && static_cast<size_t>(len) < size)
+        snprintf(buffer + len, size - len, "; kcal: %u; fat: %u.%u; tbw: %u.%u; muscle: %u.%u; bone: %u.%u", kcal,
+                 fat / BODY_SCALE, fat % BODY_SCALE, tbw / BODY_SCALE, tbw % BODY_SCALE, muscle / BODY_SCALE,
+                 muscle % BODY_SCALE, bone / BODY_SCALE, bone % BODY_SCALE);
+      return buffer;
+    }
+
+    Measurement *UserHistory::record_(uint32_t timestamp)
+    {
+      // records are sorted on timestamp, find the insert position from the back
+      // as the scale sends its history roughly in order
+      uint8_t pos = count_;
+      while (pos > 0 && records_[pos - 1].timestamp >= timestamp)
+      {
+        if (records_[pos - 1].timestamp == timestamp)
+          return &records_[pos - 1];
+        pos--;
+      }
+
+      if (count_ == HISTORY_SIZE)
+      {
+        // full: older than everything we have, or make room by dropping the oldest
+        if (pos == 0)
+          return nullptr;
+        memmove(&records_[0], &records_[1], (pos - 1) * sizeof(Measurement));
+        pos--;
+      }
+      else
+      {
+        memmove(&records_[pos + 1], &records_[pos], (count_ - pos) * sizeof(Measurement));
+        count_++;
+      }
+
+      records_[pos] = Measurement();
+      records_[pos].timestamp = timestamp;
+      return &records_[pos];
+    }
+
+    bool UserHistory::add(const Weight &weight)
+    {
+      auto *record = record_(weight.timestamp);
+      if (record == nullptr || record->has_weight())
+        return false;
+      record->weight = weight.weight;
+      record->flags |= Measurement::HAS_WEIGHT | Measurement::PENDING;
+      return true;
+    }
+
+    bool UserHistory::add(const Body &body)
+    {
+      auto *record = record_(body.timestamp);
+      if (record == nullptr || record->has_body())
+        return false;
+      record->kcal = body.kcal;
+      record->fat = body.fat;
+      record->tbw = body.tbw;
+      record->muscle = body.muscle;
+      record->bone = body.bone;
+      record->flags |= Measurement::HAS_BODY | Measurement::PENDING;
+      return true;
+    }
+
+    const Measurement *UserHistory::newest(uint16_t flags) const
+    {
+      for (uint8_t i = count_; i > 0; i--)
+      {
+        if ((records_[i - 1].flags & flags) == flags)
+          return &records_[i - 1];
+      }
+      return nullptr;
+    }
+  } // namespace medisana_bs444
+} // namespace esphome
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+#include "Scale.h"
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    // the scale keeps the last 30 measurements for each of its 8 persons
+    static constexpr size_t HISTORY_SIZE = 30;
+    static constexpr uint8_t MAX_PERSONS = 8;
+
+    // One weigh-in as kept in the history. The weight and the body packet of a
+    // measurement carry the same timestamp and are merged into one record.
+    // Values are kept as integers in the units the scale sends them.
+    class Measurement
+    {
+    public:
+      static constexpr uint16_t HAS_WEIGHT = 0x01;
+      static constexpr uint16_t HAS_BODY = 0x02;
+      static constexpr uint16_t PENDING = 0x04; // not handed out by take_pending() yet
+
+    public:
+      uint32_t timestamp = 0;
+      uint16_t weight = 0; // 1/WEIGHT_SCALE kg
+      uint16_t kcal = 0;
+      uint16_t fat = 0;    // 1/BODY_SCALE %
+      uint16_t tbw = 0;    // 1/BODY_SCALE %
+      uint16_t muscle = 0; // 1/BODY_SCALE %
+      uint16_t bone = 0;   // 1/BODY_SCALE kg
+      uint16_t flags = 0;
+
+      bool has_weight() const { return flags & HAS_WEIGHT; }
+      bool has_body() const { return flags & HAS_BODY; }
+
+      // for publishing, everything else works on the integers
+      float weight_kg() const { return float(weight) / WEIGHT_SCALE; }
+      float fat_percent() const { return float(fat) / BODY_SCALE; }
+      float tbw_percent() const { return float(tbw) / BODY_SCALE; }
+      float muscle_percent() const { return float(muscle) / BODY_SCALE; }
+      float bone_kg() const { return float(bone) / BODY_SCALE; }
+
+      const char *format(char *buffer, size_t size, TimeFormatter &time) const;
+    };
+    static_assert(sizeof(Measurement) == 20, "keep the history records packed");
+
+    // The measurements of one person, oldest first, unique per timestamp.
+    // Holds at most HISTORY_SIZE records, the oldest one is dropped when full.
+    class UserHistory
+    {
+    public:
+      // false if the record is a duplicate or older than a full history
+      bool add(const Weight &weight);
+      bool add(const Body &body);
+
+      size_t size() const { return count_; }
+      const Measurement &operator[](size_t i) const { return records_[i]; }
+
+      // newest record having all of flags, nullptr if there is none
+      const Measurement *newest(uint16_t flags) const;
+
+      // calls f for every record not handed out yet, oldest first. A record
+      // still missing its weight or body waits for it, unless a newer record
+      // is complete: the scale sends both, a gap before that is a lost packet.
+      template <typename F>
+      size_t take_pending(F &&f)
+      {
+        const auto *complete = this->newest(Measurement::HAS_WEIGHT | Measurement::HAS_BODY);
+        if (complete == nullptr)
+          return 0;
+        size_t taken = 0;
+        for (uint8_t i = 0; i < count_; i++)
+        {
+          if ((records_[i].flags & Measurement::PENDING) && (records_[i].timestamp <= complete->timestamp))
+          {
+            records_[i].flags &= ~Measurement::PENDING;
+            f(records_[i]);
+            taken++;
+          }
+        }
+        return taken;
+      }
+
+    private:
+      Measurement *record_(uint32_t timestamp);
+
+      std::array<Measurement, HISTORY_SIZE> records_;
+      uint8_t count_ = 0;
+    };
+  } // namespace medisana_bs444
+} // namespace esphome
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <span>
+
+#include "History.h"
+#include "Protocol.h"
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    // The history dump of a session, from the decoded packets to the records
+    // handed out. Weight and body packets are checked against the sync
+    // watermark of their person and the node's clock and go into the history
+    // of the person. At the end of the session the new records of the person
+    // on the scale are handed out and the watermark advances.
+    //
+    // No ESPHome or ESP-IDF in here: MedisanaBS444 drives it from loop(), the
+    // host tools in host/ drive the same code.
+    template <typename Model>
+    class HistorySync
+    {
+    public:
+      // the scale's clock may run ahead of the node this much, in seconds
+      static constexpr time_t CLOCK_TOLERANCE = 5 * 60;
+
+      enum class Result : uint8_t
+      {
+        ADDED,
+        SYNCED,    // handed out in an earlier session
+        DUPLICATE, // in the history already
+        FUTURE,    // later than the node's clock
+        MALFORMED,
+        NO_PERSON, // no valid person number
+      };
+
+      // a new session, the person of the last one no longer counts
+      void start()
+      {
+        person_ = Person();
+        weights_.clear();
+        bodies_.clear();
+      }
+
+      const Person &person(std::span<const uint8_t> payload)
+      {
+        person_ = Person::decode<Model>(payload);
+        return person_;
+      }
+      const Person &person() const { return person_; }
+
+      // now is the node's unix time, the decoded packet is valid for ADDED
+      Result add(std::span<const uint8_t> payload, time_t now, Weight &weight)
+      {
+        const auto key = WeightView<Model>(payload).key();
+        weights_.add(key);
+        if (this->is_synced(key.person, key.timestamp))
+          return Result::SYNCED;
+        weight = Weight::decode<Model>(payload);
+        return this->check_(weight, now, [&](UserHistory &history)
+                            { return history.add(weight); });
+      }
+      Result add(std::span<const uint8_t> payload, time_t now, Body &body)
+      {
+        const auto key = BodyView<Model>(payload).key();
+        bodies_.add(key);
+        if (this->is_synced(key.person, key.timestamp))
+          return Result::SYNCED;
+        body = Body::decode<Model>(payload);
+        return this->check_(body, now, [&](UserHistory &history)
+                            { return history.add(body); });
+      }
+
+      // the scale sent its full history, weight and body for each record; an
+      // indication the scale sends again does not count twice
+      bool complete() const { return (weights_.size() >= HISTORY_SIZE) && (bodies_.size() >= HISTORY_SIZE); }
+
+      // true if a packet with this scale time was handled in an earlier session
+      bool is_synced(uint32_t person, uint32_t raw_timestamp) const
+      {
+        return (person >= 1) && (person <= MAX_PERSONS) &&
+               time_t(raw_timestamp) <= time_t(watermarks_[person - 1]) - Model::EPOCH;
+      }
+
+      // nullptr until a record of the person was added
+      UserHistory *history(uint32_t person) const
+      {
+        return ((person >= 1) && (person <= MAX_PERSONS)) ? history_[person - 1].get() : nullptr;
+      }
+
+      // calls f for the new records of the person on the scale, oldest first;
+      // f returns false for a record it could not deliver yet, delivered()
+      // follows once it is. Returns the number of records.
+      template <typename F>
+      size_t hand_out(F &&f)
+      {
+        auto *history = this->history(person_.person);
+        if (!person_.valid || (history == nullptr))
+          return 0;
+        const uint8_t person = person_.person;
+        return history->take_pending([this, person, &f](const Measurement &measurement)
+                                     {
+                                       if (f(measurement))
+                                         this->delivered(person, measurement); });
+      }
+
+      // advances the watermark; only to a complete record, a record still
+      // waiting for its body must not count as synced in the next session
+      void delivered(uint8_t person, const Measurement &measurement)
+      {
+        if ((person >= 1) && (person <= MAX_PERSONS) && measurement.has_weight() && measurement.has_body())
+          this->advance_(person - 1, measurement.timestamp);
+      }
+
+      // newest timestamp handed out per person, to keep in flash
+      std::array<uint32_t, MAX_PERSONS> &watermarks() { return watermarks_; }
+      // true once after the watermarks changed, the caller saves them
+      bool watermarks_changed()
+      {
+        const bool changed = watermarks_changed_;
+        watermarks_changed_ = false;
+        return changed;
+      }
+
+    protected:
+      // the distinct records of one kind in the dump of this session, the
+      // scale dumps the history of one person
+      class Dumped
+      {
+      public:
+        void clear() { count_ = 0; }
+        void add(const SyncKey &key)
+        {
+          if (!key.person || (count_ == HISTORY_SIZE))
+            return;
+          for (uint8_t i = 0; i < count_; i++)
+          {
+            if (timestamps_[i] == key.timestamp)
+              return;
+          }
+          timestamps_[count_++] = key.timestamp;
+        }
+        size_t size() const { return count_; }
+
+      private:
+        std::array<uint32_t, HISTORY_SIZE> timestamps_;
+        uint8_t count_ = 0;
+      };
+
+      template <typename T, typename A>
+      Result check_(const T &data, time_t now, A &&add)
+      {
+        if (!data.valid)
+          return Result::MALFORMED;
+        if (data.timestamp > now + CLOCK_TOLERANCE)
+          return Result::FUTURE;
+        if ((data.person < 1) || (data.person > MAX_PERSONS))
+          return Result::NO_PERSON;
+        // only persons that actually use the scale get a history
+        auto &history = history_[data.person - 1];
+        if (!history)
+          history = std::make_unique<UserHistory>();
+        return add(*history) ? Result::ADDED : Result::DUPLICATE;
+      }
+
+      void advance_(uint8_t index, uint32_t timestamp)
+      {
+        if (timestamp <= watermarks_[index])
+          return;
+        watermarks_[index] = timestamp;
+        watermarks_changed_ = true;
+      }
+
+      Person person_;
+      // measurements per person, allocated when the person is first seen
+      std::unique_ptr<UserHistory> history_[MAX_PERSONS];
+      std::array<uint32_t, MAX_PERSONS> watermarks_{};
+      bool watermarks_changed_ = false;
+      Dumped weights_;
+      Dumped bodies_;
+    };
+  } // namespace medisana_bs444
+} // namespace esphome
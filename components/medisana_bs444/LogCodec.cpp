@@ -0,0 +1,116 @@
+#include "LogCodec.h"
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    static constexpr uint8_t LOG_WEIGHT = 0x10;
+    static constexpr uint8_t LOG_BODY = 0x20;
+
+    size_t LogCodec::put_(uint8_t *out, int32_t delta)
+    {
+      // zigzag: small negative deltas stay small
+      uint32_t value = (uint32_t(delta) << 1) ^ uint32_t(delta >> 31);
+      size_t n = 0;
+      while (value >= 0x80)
+      {
+        out[n++] = uint8_t(value) | 0x80;
+        value >>= 7;
+      }
+      out[n++] = uint8_t(value);
+      return n;
+    }
+
+    size_t LogCodec::get_(const uint8_t *data, size_t size, int32_t &delta)
+    {
+      uint32_t value = 0;
+      for (size_t n = 0; (n < size) && (n < 5); n++)
+      {
+        value |= uint32_t(data[n] & 0x7f) << (7 * n);
+        if ((data[n] & 0x80) == 0)
+        {
+          delta = int32_t(value >> 1) ^ -int32_t(value & 1);
+          return n + 1;
+        }
+      }
+      return 0;
+    }
+
+    size_t LogCodec::encode(uint8_t person, const Measurement &measurement, Context &context, uint8_t *out)
+    {
+      if ((person < 1) || (person > MAX_PERSONS) || !(measurement.has_weight() || measurement.has_body()))
+        return 0;
+      auto &last = context.last[person - 1];
+      size_t n = 0;
+      out[n++] = (person - 1) | (measurement.has_weight() ? LOG_WEIGHT : 0) | (measurement.has_body() ? LOG_BODY : 0);
+      n += put_(out + n, int32_t(measurement.timestamp - context.timestamp));
+      if (measurement.has_weight())
+      {
+        n += put_(out + n, int32_t(measurement.weight) - last.weight);
+        last.weight = measurement.weight;
+      }
+      if (measurement.has_body())
+      {
+        n += put_(out + n, int32_t(measurement.kcal) - last.kcal);
+        n += put_(out + n, int32_t(measurement.fat) - last.fat);
+        n += put_(out + n, int32_t(measurement.tbw) - last.tbw);
+        n += put_(out + n, int32_t(measurement.muscle) - last.muscle);
+        n += put_(out + n, int32_t(measurement.bone) - last.bone);
+        last.kcal = measurement.kcal;
+        last.fat = measurement.fat;
+        last.tbw = measurement.tbw;
+        last.muscle = measurement.muscle;
+        last.bone = measurement.bone;
+      }
+      context.timestamp = measurement.timestamp;
+      return n;
+    }
+
+    size_t LogCodec::decode(const uint8_t *data, size_t size, Context &context, uint8_t &person, Measurement &measurement)
+    {
+      if ((size == 0) || (data[0] & 0xc0) || ((data[0] & (LOG_WEIGHT | LOG_BODY)) == 0) ||
+          ((data[0] & 0x0f) >= MAX_PERSONS))
+        return 0;
+      person = (data[0] & 0x0f) + 1;
+      // decode into a copy, the context only moves on for a complete record
+      auto last = context.last[person - 1];
+      size_t n = 1;
+      int32_t delta;
+      auto next = [&](uint16_t &value) -> bool
+      {
+        const size_t used = get_(data + n, size - n, delta);
+        n += used;
+        value += delta;
+        return used != 0;
+      };
+
+      size_t used = get_(data + n, size - n, delta);
+      if (used == 0)
+        return 0;
+      n += used;
+      measurement = Measurement();
+      measurement.timestamp = context.timestamp + delta;
+      if (data[0] & LOG_WEIGHT)
+      {
+        if (!next(last.weight))
+          return 0;
+        measurement.weight = last.weight;
+        measurement.flags |= Measurement::HAS_WEIGHT;
+      }
+      if (data[0] & LOG_BODY)
+      {
+        if (!next(last.kcal) || !next(last.fat) || !next(last.tbw) || !next(last.muscle) || !next(last.bone))
+          return 0;
+        measurement.kcal = last.kcal;
+        measurement.fat = last.fat;
+        measurement.tbw = last.tbw;
+        measurement.muscle = last.muscle;
+        measurement.bone = last.bone;
+        measurement.flags |= Measurement::HAS_BODY;
+      }
+      context.last[person - 1] = last;
+      context.timestamp = measurement.timestamp;
+      return n;
+    }
+  } // namespace medisana_bs444
+} // namespace esphome
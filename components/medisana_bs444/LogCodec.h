@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "History.h"
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    // Compact encoding of the measurements in the flash log. A record is
+    //
+    //   header   bits 0-3 person - 1, bit 4 weight, bit 5 body, bits 6-7 zero
+    //            (so a header is never 0xff, erased flash)
+    //   varint   timestamp, zigzag delta to the previous record
+    //   varint   weight, zigzag delta to the previous weight of the person
+    //   5 varint kcal, fat, tbw, muscle, bone, same deltas (body only)
+    //
+    // Deltas run over a sequence of records that starts with an empty
+    // context, a typical weigh-in takes 10 to 14 bytes instead of 20.
+    class LogCodec
+    {
+    public:
+      static constexpr size_t MAX_RECORD_SIZE = 1 + 5 + 6 * 3;
+
+      struct Context
+      {
+        uint32_t timestamp = 0;
+        Measurement last[MAX_PERSONS];
+      };
+
+      // bytes written to out (at least MAX_RECORD_SIZE), 0 if the record can not be logged
+      static size_t encode(uint8_t person, const Measurement &measurement, Context &context, uint8_t *out);
+      // bytes used, 0 at erased flash or when the record is corrupt or incomplete
+      static size_t decode(const uint8_t *data, size_t size, Context &context, uint8_t &person, Measurement &measurement);
+
+    private:
+      static size_t put_(uint8_t *out, int32_t delta);
+      static size_t get_(const uint8_t *data, size_t size, int32_t &delta);
+    };
+  } // namespace medisana_bs444
+} // namespace esphome
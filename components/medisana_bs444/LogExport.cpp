@@ -0,0 +1,160 @@
+#include "LogExport.h"
+
+#ifdef USE_MEDISANA_BS444_LOG
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    static constexpr const char *CSV_HEADER = "person,timestamp,weight,kcal,fat,tbw,muscle,bone\n";
+
+    LogExport::LogExport(const MeasurementLog &log, const char *partition)
+        : log_(log), csv_path_(std::string("/medisana_bs444/") + partition + ".csv"),
+          json_path_(std::string("/medisana_bs444/") + partition + ".json")
+    {
+    }
+
+    bool LogExport::canHandle(AsyncWebServerRequest *request) const
+    {
+      if (request->method() != HTTP_GET)
+        return false;
+      const auto url = request->url();
+      return (url == csv_path_.c_str()) || (url == json_path_.c_str());
+    }
+
+    size_t LogExport::format_csv(char *buffer, size_t size, uint8_t person, const Measurement &m)
+    {
+      int len = snprintf(buffer, size, "%u,%" PRIu32 ",", person, m.timestamp);
+      if (m.has_weight() && len >= 0 && size_t(len) < size)
+        len += snprintf(buffer + len, size - len, "%u.%02u", m.weight / WEIGHT_SCALE, m.weight % WEIGHT_SCALE);
+      if (len >= 0 && size_t(len) < size)
+      {
+        if (m.has_body())
+          len += snprintf(buffer + len, size - len, ",%u,%u.%u,%u.%u,%u.%u,%u.%u\n", m.kcal, m.fat / BODY_SCALE,
+                          m.fat % BODY_SCALE, m.tbw / BODY_SCALE, m.tbw % BODY_SCALE, m.muscle / BODY_SCALE,
+                          m.muscle % BODY_SCALE, m.bone / BODY_SCALE, m.bone % BODY_SCALE);
+        else
+          len += snprintf(buffer + len, size - len, ",,,,,\n");
+      }
+      return len < 0 ? 0 : std::min(size_t(len), size - 1);
+    }
+
+    size_t LogExport::format_json(char *buffer, size_t size, uint8_t person, const Measurement &m, bool first)
+    {
+      int len = snprintf(buffer, size, "%s{\"person\":%u,\"timestamp\":%" PRIu32, first ? "" : ",", person, m.timestamp);
+      if (m.has_weight() && len >= 0 && size_t(len) < size)
+        len += snprintf(buffer + len, size - len, ",\"weight\":%u.%02u", m.weight / WEIGHT_SCALE, m.weight % WEIGHT_SCALE);
+      if (m.has_body() && len >= 0 && size_t(len) < size)
+        len += snprintf(buffer + len, size - len,
+                        ",\"kcal\":%u,\"fat\":%u.%u,\"tbw\":%u.%u,\"muscle\":%u.%u,\"bone\":%u.%u", m.kcal,
+                        m.fat / BODY_SCALE, m.fat % BODY_SCALE, m.tbw / BODY_SCALE, m.tbw % BODY_SCALE,
+                        m.muscle / BODY_SCALE, m.muscle % BODY_SCALE, m.bone / BODY_SCALE, m.bone % BODY_SCALE);
+      if (len >= 0 && size_t(len) < size)
+        len += snprintf(buffer + len, size - len, "}");
+      return len < 0 ? 0 : std::min(size_t(len), size - 1);
+    }
+
+    // Fills the chunks of the response from a reader on the log.
+    class ExportStream
+    {
+    public:
+      static constexpr size_t ROW_SIZE = 128;
+
+      ExportStream(const MeasurementLog &log, bool json) : reader_(log), json_(json) {}
+
+      // at most size bytes of the export, 0 at the end
+      size_t read(uint8_t *buffer, size_t size)
+      {
+        size_t len = 0;
+        while (len < size)
+        {
+          if (pos_ == row_len_ && !this->next_row_())
+            break;
+          const size_t n = std::min(size - len, row_len_ - pos_);
+          memcpy(buffer + len, row_ + pos_, n);
+          pos_ += n;
+          len += n;
+        }
+        return len;
+      }
+
+    protected:
+      bool next_row_()
+      {
+        pos_ = 0;
+        row_len_ = 0;
+        if (state_ == START)
+        {
+          row_len_ = snprintf(row_, sizeof(row_), "%s", json_ ? "[" : CSV_HEADER);
+          state_ = ROWS;
+          return true;
+        }
+        if (state_ == ROWS)
+        {
+          uint8_t person;
+          Measurement measurement;
+          if (reader_.next(person, measurement))
+          {
+            row_len_ = json_ ? LogExport::format_json(row_, sizeof(row_), person, measurement, first_)
+                             : LogExport::format_csv(row_, sizeof(row_), person, measurement);
+            first_ = false;
+            return true;
+          }
+          state_ = DONE;
+          if (json_)
+          {
+            row_len_ = snprintf(row_, sizeof(row_), "]\n");
+            return true;
+          }
+        }
+        return false;
+      }
+
+      enum State : uint8_t
+      {
+        START,
+        ROWS,
+        DONE
+      };
+
+      MeasurementLog::Reader reader_;
+      bool json_;
+      bool first_ = true;
+      State state_ = START;
+      char row_[ROW_SIZE];
+      size_t row_len_ = 0;
+      size_t pos_ = 0;
+    };
+
+    void LogExport::handleRequest(AsyncWebServerRequest *request)
+    {
+      const bool json = request->url() == json_path_.c_str();
+      const char *type = json ? "application/json" : "text/csv";
+#ifdef USE_ESP_IDF
+      httpd_req_t *req = *request;
+      httpd_resp_set_type(req, type);
+      ExportStream stream(log_, json);
+      // flash reads are fast, the socket sets the pace
+      uint8_t chunk[1024];
+      while (size_t len = stream.read(chunk, sizeof(chunk)))
+      {
+        if (httpd_resp_send_chunk(req, reinterpret_cast<const char *>(chunk), len) != ESP_OK)
+          return;
+      }
+      httpd_resp_send_chunk(req, nullptr, 0);
+#else
+      auto stream = std::make_shared<ExportStream>(log_, json);
+      request->send(request->beginChunkedResponse(type, [stream](uint8_t *buffer, size_t max_len, size_t index) -> size_t
+                                                  { return stream->read(buffer, max_len); }));
+#endif
+    }
+  } // namespace medisana_bs444
+} // namespace esphome
+
+#endif // USE_MEDISANA_BS444_LOG
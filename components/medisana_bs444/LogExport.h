@@ -0,0 +1,39 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+#ifdef USE_MEDISANA_BS444_LOG
+
+#include "esphome/components/web_server_base/web_server_base.h"
+
+#include <string>
+
+#include "MeasurementLog.h"
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    // Serves the measurement log as /medisana_bs444/<partition>.csv and .json.
+    // The response is sent in chunks while the log is read, it is never held
+    // in RAM as a whole.
+    class LogExport : public AsyncWebHandler
+    {
+    public:
+      LogExport(const MeasurementLog &log, const char *partition);
+
+      bool canHandle(AsyncWebServerRequest *request) const override;
+      void handleRequest(AsyncWebServerRequest *request) override;
+
+      // one row of the export, the length written to buffer (snprintf-style)
+      static size_t format_csv(char *buffer, size_t size, uint8_t person, const Measurement &measurement);
+      static size_t format_json(char *buffer, size_t size, uint8_t person, const Measurement &measurement, bool first);
+
+    protected:
+      const MeasurementLog &log_;
+      std::string csv_path_;
+      std::string json_path_;
+    };
+  } // namespace medisana_bs444
+} // namespace esphome
+
+#endif // USE_MEDISANA_BS444_LOG
@@ -0,0 +1,62 @@
+#include "MeasurementIndex.h"
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    MeasurementIndex &MeasurementIndex::instance()
+    {
+      static MeasurementIndex index;
+      return index;
+    }
+
+    size_t MeasurementIndex::slot_(uint8_t person, uint32_t bucket)
+    {
+      return ((bucket * 2654435761u) ^ (person * 40503u)) % SLOTS;
+    }
+
+    bool MeasurementIndex::contains(uint8_t person, uint32_t timestamp, uint8_t scale, uint16_t weight) const
+    {
+      // a match within TOLERANCE is in the same or a neighbouring bucket
+      const uint32_t bucket = timestamp / TOLERANCE;
+      for (uint32_t b = bucket - 1; b != bucket + 2; b++)
+      {
+        const auto &entry = entries_[slot_(person, b)];
+        if (entry.person != person)
+          continue;
+        // one scale does not repeat a timestamp, a second weigh-in on it is new
+        if (entry.scale == scale)
+        {
+          if (entry.timestamp == timestamp)
+            return true;
+          continue;
+        }
+        const uint32_t delta = entry.timestamp > timestamp ? entry.timestamp - timestamp : timestamp - entry.timestamp;
+        const uint16_t difference = entry.weight > weight ? entry.weight - weight : weight - entry.weight;
+        if ((delta <= TOLERANCE) && (difference <= WEIGHT_TOLERANCE))
+          return true;
+      }
+      return false;
+    }
+
+    bool MeasurementIndex::add(uint8_t person, uint32_t timestamp, uint8_t scale, uint16_t weight)
+    {
+      if ((person < 1) || (person > MAX_PERSONS) || this->contains(person, timestamp, scale, weight))
+        return false;
+      // a backlog handed out late must not push out the newer weigh-ins
+      auto &entry = entries_[slot_(person, timestamp / TOLERANCE)];
+      if ((entry.person == 0) || (entry.timestamp <= timestamp))
+        entry = Entry{.timestamp = timestamp, .weight = weight, .person = person, .scale = scale};
+      if (timestamp > newest_[person - 1])
+        newest_[person - 1] = timestamp;
+      return true;
+    }
+
+    bool MeasurementIndex::is_current(uint8_t person, uint32_t timestamp) const
+    {
+      if ((person < 1) || (person > MAX_PERSONS))
+        return false;
+      return timestamp + TOLERANCE >= newest_[person - 1];
+    }
+  } // namespace medisana_bs444
+} // namespace esphome
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "History.h"
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    // Measurements handed out by any of the scales of the node, so the scales
+    // of one household form a single stream per person. A weigh-in that was
+    // handed out already is recognised as a duplicate: from the same scale it
+    // has the same timestamp (again after a reset), from another scale it is
+    // within TOLERANCE and weighs within WEIGHT_TOLERANCE. Older weigh-ins are
+    // still handed out, but do not replace the state of the entities.
+    //
+    // The person is the person number on the scale (1..8), not a user of the
+    // node: merged scales need the same number for one household member.
+    //
+    // Direct mapped on person and timestamp / TOLERANCE: a lookup checks three
+    // slots, a colliding measurement only replaces an older one.
+    class MeasurementIndex
+    {
+    public:
+      static constexpr size_t SLOTS = 128;
+      // clocks of two scales differ this much at most, in seconds
+      static constexpr uint32_t TOLERANCE = 120;
+      // two scales weigh one person this close, in 1/WEIGHT_SCALE kg
+      static constexpr uint16_t WEIGHT_TOLERANCE = WEIGHT_SCALE / 2;
+
+      // shared by all scales on the node
+      static MeasurementIndex &instance();
+
+      // false if the measurement was handed out already, scale is the id of
+      // the scale in SessionScheduler
+      bool add(uint8_t person, uint32_t timestamp, uint8_t scale, uint16_t weight);
+      bool contains(uint8_t person, uint32_t timestamp, uint8_t scale, uint16_t weight) const;
+      // whether nothing newer of the person was handed out
+      bool is_current(uint8_t person, uint32_t timestamp) const;
+
+    private:
+      struct Entry
+      {
+        uint32_t timestamp = 0;
+        uint16_t weight = 0; // 1/WEIGHT_SCALE kg, 0 without weight
+        uint8_t person = 0;  // 0: empty
+        uint8_t scale = 0;
+      };
+
+      static size_t slot_(uint8_t person, uint32_t bucket);
+
+      std::array<Entry, SLOTS> entries_{};
+      std::array<uint32_t, MAX_PERSONS> newest_{};
+    };
+  } // namespace medisana_bs444
+} // namespace esphome
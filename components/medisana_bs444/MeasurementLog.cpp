@@ -0,0 +1,205 @@
+#include "MeasurementLog.h"
+
+#ifdef USE_MEDISANA_BS444_LOG
+
+#include "esphome/core/log.h"
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    static const char *TAG = "MedisanaBS444.log";
+
+    bool MeasurementLog::read_header_(size_t sector, uint32_t &sequence) const
+    {
+      uint32_t header[2];
+      if (esp_partition_read(partition_, sector * SPI_FLASH_SEC_SIZE, header, sizeof(header)) != ESP_OK)
+        return false;
+      sequence = header[1];
+      return header[0] == MAGIC;
+    }
+
+    bool MeasurementLog::start_sector_(size_t sector, uint32_t sequence)
+    {
+      if (esp_partition_erase_range(partition_, sector * SPI_FLASH_SEC_SIZE, SPI_FLASH_SEC_SIZE) != ESP_OK)
+        return false;
+      const uint32_t header[2] = {MAGIC, sequence};
+      if (esp_partition_write(partition_, sector * SPI_FLASH_SEC_SIZE, header, sizeof(header)) != ESP_OK)
+        return false;
+      sector_ = sector;
+      sequence_ = sequence;
+      offset_ = HEADER_SIZE;
+      context_ = LogCodec::Context();
+      return true;
+    }
+
+    bool MeasurementLog::open(const char *label)
+    {
+      partition_ = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+      if ((partition_ == nullptr) || (sectors_() < 2))
+      {
+        ESP_LOGE(TAG, "No data partition '%s' of at least 2 sectors", label);
+        partition_ = nullptr;
+        return false;
+      }
+
+      // the newest sector has the highest sequence
+      bool found = false;
+      erased_ = 0;
+      for (size_t sector = 0; sector < sectors_(); sector++)
+      {
+        uint32_t sequence;
+        if (!read_header_(sector, sequence))
+          continue;
+        erased_++;
+        if (!found || (int32_t(sequence - sequence_) > 0))
+        {
+          found = true;
+          sector_ = sector;
+          sequence_ = sequence;
+        }
+      }
+      if (!found)
+      {
+        ESP_LOGI(TAG, "Starting a new log in '%s'", label);
+        erased_ = 1;
+        return start_sector_(0, 1);
+      }
+
+      // replay the newest sector to find its end and the context to continue with
+      context_ = LogCodec::Context();
+      offset_ = HEADER_SIZE;
+      uint8_t buffer[LogCodec::MAX_RECORD_SIZE];
+      while (offset_ < SPI_FLASH_SEC_SIZE)
+      {
+        const size_t size = std::min(sizeof(buffer), SPI_FLASH_SEC_SIZE - offset_);
+        if (esp_partition_read(partition_, sector_ * SPI_FLASH_SEC_SIZE + offset_, buffer, size) != ESP_OK)
+          break;
+        uint8_t person;
+        Measurement measurement;
+        const size_t used = LogCodec::decode(buffer, size, context_, person, measurement);
+        if (used == 0)
+        {
+          // a record cut off by a reset can not be appended to, continue in a fresh sector
+          if (buffer[0] != 0xff)
+          {
+            ESP_LOGW(TAG, "Corrupt record at %u, continuing in the next sector", (unsigned)offset_);
+            offset_ = SPI_FLASH_SEC_SIZE;
+          }
+          break;
+        }
+        offset_ += used;
+      }
+      ESP_LOGD(TAG, "Log '%s': sector %u of %u at %u", label, (unsigned)sector_, (unsigned)sectors_(), (unsigned)offset_);
+      return true;
+    }
+
+    bool MeasurementLog::append(uint8_t person, const Measurement &measurement)
+    {
+      if (partition_ == nullptr)
+        return false;
+      LockGuard guard(lock_);
+      uint8_t record[LogCodec::MAX_RECORD_SIZE];
+      auto context = context_;
+      size_t size = LogCodec::encode(person, measurement, context, record);
+      if (size == 0)
+        return false;
+      if (offset_ + size > SPI_FLASH_SEC_SIZE)
+      {
+        // drops the oldest sector once the ring is full
+        if (!start_sector_((sector_ + 1) % sectors_(), sequence_ + 1))
+          return false;
+        if (erased_ < sectors_())
+          erased_++;
+        context = context_;
+        size = LogCodec::encode(person, measurement, context, record);
+      }
+      if (esp_partition_write(partition_, sector_ * SPI_FLASH_SEC_SIZE + offset_, record, size) != ESP_OK)
+        return false;
+      offset_ += size;
+      context_ = context;
+      return true;
+    }
+
+    size_t MeasurementLog::capacity() const { return partition_ ? partition_->size : 0; }
+
+    size_t MeasurementLog::used() const
+    {
+      return partition_ ? (erased_ - 1) * SPI_FLASH_SEC_SIZE + offset_ : 0;
+    }
+
+    MeasurementLog::Reader::Reader(const MeasurementLog &log) : log_(log)
+    {
+      if (log.partition_ == nullptr)
+        return;
+      LockGuard guard(log.lock_);
+      // the oldest sector follows the newest in the ring, unless it was never used
+      sectors_left_ = log.erased_;
+      sector_ = (log.sector_ + log.sectors_() - log.erased_ + 1) % log.sectors_();
+      sequence_ = log.sequence_ - log.erased_ + 1;
+      end_ = log.offset_;
+      start_sector_();
+    }
+
+    bool MeasurementLog::Reader::read_(uint8_t *buffer, size_t size)
+    {
+      LockGuard guard(log_.lock_);
+      uint32_t sequence;
+      if (!log_.read_header_(sector_, sequence) || (sequence != sequence_))
+        return false;
+      return (size == 0) ||
+             (esp_partition_read(log_.partition_, sector_ * SPI_FLASH_SEC_SIZE + offset_, buffer, size) == ESP_OK);
+    }
+
+    void MeasurementLog::Reader::next_sector_()
+    {
+      sector_ = (sector_ + 1) % log_.sectors_();
+      sequence_++;
+      sectors_left_--;
+    }
+
+    bool MeasurementLog::Reader::start_sector_()
+    {
+      while (sectors_left_ > 0)
+      {
+        offset_ = HEADER_SIZE;
+        if (this->read_(nullptr, 0))
+        {
+          context_ = LogCodec::Context();
+          return true;
+        }
+        this->next_sector_();
+      }
+      return false;
+    }
+
+    bool MeasurementLog::Reader::next(uint8_t &person, Measurement &measurement)
+    {
+      while (sectors_left_ > 0)
+      {
+        // records appended after the reader was made are left for the next one
+        const size_t end = (sectors_left_ == 1) ? end_ : SPI_FLASH_SEC_SIZE;
+        if (offset_ < end)
+        {
+          uint8_t buffer[LogCodec::MAX_RECORD_SIZE];
+          const size_t size = std::min(sizeof(buffer), end - offset_);
+          if (this->read_(buffer, size))
+          {
+            const size_t used = LogCodec::decode(buffer, size, context_, person, measurement);
+            if (used)
+            {
+              offset_ += used;
+              return true;
+            }
+          }
+        }
+        // end of this sector
+        this->next_sector_();
+        this->start_sector_();
+      }
+      return false;
+    }
+  } // namespace medisana_bs444
+} // namespace esphome
+
+#endif // USE_MEDISANA_BS444_LOG
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+#ifdef USE_MEDISANA_BS444_LOG
+
+#include "esphome/core/helpers.h"
+
+#include <esp_partition.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "LogCodec.h"
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    // Append-only log of all measurements in a data partition of its own.
+    // The partition is used as a ring of flash sectors: records are only ever
+    // appended, a sector is erased once per trip around the ring, when the
+    // log wraps and its oldest records are dropped. Every sector starts with
+    // a header and a fresh LogCodec context, so it can be read on its own.
+    class MeasurementLog
+    {
+    public:
+      static constexpr uint32_t MAGIC = 0x3153424d; // "MBS1"
+      static constexpr size_t HEADER_SIZE = 8;      // magic, sequence
+
+      // finds the end of the log, false if there is no such partition
+      bool open(const char *label);
+      bool is_open() const { return partition_ != nullptr; }
+      bool append(uint8_t person, const Measurement &measurement);
+
+      size_t capacity() const;
+      size_t used() const;
+
+      // Reads the log from the oldest record up to where it ended when the
+      // reader was made. It runs on the web server task while loop() appends:
+      // it starts from a copy of the log's position taken under the lock and
+      // reads flash under the lock too, a sector that was erased and reused
+      // since is skipped.
+      class Reader
+      {
+      public:
+        explicit Reader(const MeasurementLog &log);
+        bool next(uint8_t &person, Measurement &measurement);
+
+      private:
+        bool start_sector_();
+        // false if the sector is no longer the one the walk expects, size 0
+        // only checks that
+        bool read_(uint8_t *buffer, size_t size);
+        void next_sector_();
+
+        const MeasurementLog &log_;
+        size_t sectors_left_ = 0;
+        size_t sector_ = 0;
+        uint32_t sequence_ = 0; // of sector_
+        size_t end_ = 0;        // in the last sector
+        size_t offset_ = 0;
+        LogCodec::Context context_;
+      };
+
+    protected:
+      size_t sectors_() const { return partition_->size / SPI_FLASH_SEC_SIZE; }
+      bool read_header_(size_t sector, uint32_t &sequence) const;
+      bool start_sector_(size_t sector, uint32_t sequence);
+
+      const esp_partition_t *partition_ = nullptr;
+      size_t sector_ = 0;    // being appended to
+      uint32_t sequence_ = 0; // of that sector
+      size_t offset_ = 0;    // in that sector
+      size_t erased_ = 0;    // sectors holding records
+      LogCodec::Context context_;
+      // append() and the readers on the web server task
+      mutable Mutex lock_;
+    };
+  } // namespace medisana_bs444
+} // namespace esphome
+
+#endif // USE_MEDISANA_BS444_LOG
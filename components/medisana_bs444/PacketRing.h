@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    // longest indication the scale sends (default ATT_MTU 23 - 3)
+    static constexpr size_t MAX_PACKET_SIZE = 20;
+
+    // A raw indication, or a session boundary so that the consumer sees
+    // session start, data and session end in the order they happened.
+    struct Packet
+    {
+      enum Kind : uint8_t
+      {
+        SESSION_START,
+        PERSON,
+        WEIGHT,
+        BODY,
+        SESSION_END,
+      };
+
+      Kind kind;
+      uint8_t len;
+      uint8_t data[MAX_PACKET_SIZE];
+
+      std::span<const uint8_t> payload() const { return {data, len}; }
+    };
+
+    // Single producer / single consumer ring: push() and batch()/pop() may run
+    // on different tasks without locking. The last two slots are kept for the
+    // session markers so a full ring never loses a session boundary.
+    template <size_t N>
+    class PacketRing
+    {
+      static_assert((N & (N - 1)) == 0, "N must be a power of two");
+
+    public:
+      bool push(Packet::Kind kind, const uint8_t *data = nullptr, size_t len = 0)
+      {
+        const uint32_t head = head_.load(std::memory_order_relaxed);
+        const uint32_t used = head - tail_.load(std::memory_order_acquire);
+        const bool marker = (kind == Packet::SESSION_START) || (kind == Packet::SESSION_END);
+        if (used >= (marker ? N : N - 2))
+        {
+          dropped_.fetch_add(1, std::memory_order_relaxed);
+          return false;
+        }
+        auto &packet = packets_[head & (N - 1)];
+        packet.kind = kind;
+        packet.len = len < MAX_PACKET_SIZE ? len : MAX_PACKET_SIZE;
+        if (packet.len)
+          memcpy(packet.data, data, packet.len);
+        // short packets read as zeros instead of stale data
+        memset(packet.data + packet.len, 0, MAX_PACKET_SIZE - packet.len);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+      }
+
+      // the queued packets stored back to back from the oldest on, up to where
+      // the ring wraps, so a whole history dump can be handled in one pass
+      std::span<const Packet> batch() const
+      {
+        const uint32_t tail = tail_.load(std::memory_order_relaxed);
+        const uint32_t used = head_.load(std::memory_order_acquire) - tail;
+        const uint32_t start = tail & (N - 1);
+        return {&packets_[start], used < N - start ? used : N - start};
+      }
+
+      void pop(size_t count = 1) { tail_.store(tail_.load(std::memory_order_relaxed) + count, std::memory_order_release); }
+
+      uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    private:
+      Packet packets_[N];
+      std::atomic<uint32_t> head_{0};
+      std::atomic<uint32_t> tail_{0};
+      std::atomic<uint32_t> dropped_{0};
+    };
+  } // namespace medisana_bs444
+} // namespace esphome
@@ -0,0 +1,317 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <span>
+
+#include "Scale.h"
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    // 128 bit UUID, least significant byte first as ESP-IDF stores it
+    using Uuid128 = std::array<uint8_t, 16>;
+
+    // 16 bit UUID on the Bluetooth base UUID 0000xxxx-0000-1000-8000-00805f9b34fb
+    constexpr Uuid128 base_uuid(uint16_t uuid)
+    {
+      return {0xfb, 0x34, 0x9b, 0x5f, 0x80, 0x00, 0x00, 0x80, 0x00, 0x10, 0x00, 0x00,
+              uint8_t(uuid & 0xff), uint8_t(uuid >> 8), 0x00, 0x00};
+    }
+
+    // raw value in 1/From units to 1/To units, folds away when they are equal
+    template <uint32_t From, uint32_t To>
+    constexpr uint16_t rescale(uint32_t value)
+    {
+      return (From == To) ? value : (value * To + From / 2) / From;
+    }
+
+    // Protocol descriptor of a scale model: everything decode() needs to
+    // know, all compile time constants.
+    template <time_t Epoch>
+    struct MedisanaProtocol
+    {
+      static constexpr Uuid128 SERVICE = base_uuid(0x78b2);
+      static constexpr Uuid128 CHAR_PERSON = base_uuid(0x8a82);  // person data handle 22
+      static constexpr Uuid128 CHAR_WEIGHT = base_uuid(0x8a21);  // weight data handle 25
+      static constexpr Uuid128 CHAR_BODY = base_uuid(0x8a22);    // body data handle 28
+      static constexpr Uuid128 CHAR_COMMAND = base_uuid(0x8a81); // command register handle 31
+
+      // fixed first byte of a valid packet
+      static constexpr uint8_t PERSON_VALID = 0x84;
+      static constexpr uint8_t WEIGHT_VALID = 0x1d;
+      static constexpr uint8_t BODY_VALID = 0x6f;
+
+      // shortest valid packet
+      static constexpr size_t PERSON_LENGTH = 9;
+      static constexpr size_t WEIGHT_LENGTH = 14;
+      static constexpr size_t BODY_LENGTH = 16;
+
+      // byte offsets, see the decode() functions
+      static constexpr size_t PERSON_PERSON = 2;
+      static constexpr size_t PERSON_GENDER = 4;
+      static constexpr size_t PERSON_AGE = 5;
+      static constexpr size_t PERSON_SIZE = 6;
+      static constexpr size_t PERSON_ACTIVITY = 8;
+      static constexpr size_t WEIGHT_WEIGHT = 1;
+      static constexpr size_t WEIGHT_TIME = 5;
+      static constexpr size_t WEIGHT_PERSON = 13;
+      static constexpr size_t BODY_TIME = 1;
+      static constexpr size_t BODY_PERSON = 5;
+      static constexpr size_t BODY_KCAL = 6;
+      static constexpr size_t BODY_FAT = 8;
+      static constexpr size_t BODY_TBW = 10;
+      static constexpr size_t BODY_MUSCLE = 12;
+      static constexpr size_t BODY_BONE = 14;
+
+      // unix time of scale time 0
+      static constexpr time_t EPOCH = Epoch;
+      // units of the raw values
+      static constexpr uint32_t WEIGHT_SCALE = 100;
+      static constexpr uint32_t BODY_SCALE = 10;
+    };
+
+    // BS410 and BS444 count from 1/1/2010, BS430 and BS440 from 1/1/1970
+    using BS410 = MedisanaProtocol<1262304000>;
+    using BS430 = MedisanaProtocol<0>;
+    using BS440 = MedisanaProtocol<0>;
+    using BS444 = MedisanaProtocol<1262304000>;
+
+    enum class ScaleModel : uint8_t
+    {
+      BS410,
+      BS430,
+      BS440,
+      BS444,
+    };
+
+    // person and scale time of a measurement packet, person 0 if malformed
+    struct SyncKey
+    {
+      uint8_t person;
+      uint32_t timestamp;
+    };
+
+    // The protocol of each model, the component is instantiated for the
+    // model of the configuration so the decoders are bound at compile time.
+    template <ScaleModel M>
+    struct ModelTraits;
+    template <>
+    struct ModelTraits<ScaleModel::BS410>
+    {
+      using Protocol = BS410;
+      static constexpr const char *NAME = "BS410";
+    };
+    template <>
+    struct ModelTraits<ScaleModel::BS430>
+    {
+      using Protocol = BS430;
+      static constexpr const char *NAME = "BS430";
+    };
+    template <>
+    struct ModelTraits<ScaleModel::BS440>
+    {
+      using Protocol = BS440;
+      static constexpr const char *NAME = "BS440";
+    };
+    template <>
+    struct ModelTraits<ScaleModel::BS444>
+    {
+      using Protocol = BS444;
+      static constexpr const char *NAME = "BS444";
+    };
+
+    // Typed views on a raw packet, without copying it. ok() checks the length
+    // and the validity byte, the accessors may only be used when it is true.
+    template <size_t Length, uint8_t Valid>
+    class PacketView
+    {
+    public:
+      explicit PacketView(std::span<const uint8_t> data) : data_(data) {}
+
+      bool ok() const { return (data_.size() >= Length) && (data_[0] == Valid); }
+
+    protected:
+      template <size_t Offset>
+      uint8_t u8() const
+      {
+        static_assert(Offset < Length, "field outside the packet");
+        return data_[Offset];
+      }
+      template <size_t Offset>
+      uint16_t le16() const
+      {
+        static_assert(Offset + 2 <= Length, "field outside the packet");
+        return data_[Offset] | (data_[Offset + 1] << 8);
+      }
+      template <size_t Offset>
+      uint32_t le32() const
+      {
+        static_assert(Offset + 4 <= Length, "field outside the packet");
+        return (uint32_t(data_[Offset + 3]) << 24) | (data_[Offset + 2] << 16) | (data_[Offset + 1] << 8) | data_[Offset];
+      }
+
+    private:
+      std::span<const uint8_t> data_;
+    };
+
+    template <typename Model>
+    class PersonView : public PacketView<Model::PERSON_LENGTH, Model::PERSON_VALID>
+    {
+    public:
+      using PacketView<Model::PERSON_LENGTH, Model::PERSON_VALID>::PacketView;
+
+      uint8_t person() const { return this->template u8<Model::PERSON_PERSON>(); }
+      uint8_t gender() const { return this->template u8<Model::PERSON_GENDER>(); }
+      uint8_t age() const { return this->template u8<Model::PERSON_AGE>(); }
+      uint8_t size() const { return this->template u8<Model::PERSON_SIZE>(); }
+      uint8_t activity() const { return this->template u8<Model::PERSON_ACTIVITY>(); }
+    };
+
+    template <typename Model>
+    class WeightView : public PacketView<Model::WEIGHT_LENGTH, Model::WEIGHT_VALID>
+    {
+    public:
+      using PacketView<Model::WEIGHT_LENGTH, Model::WEIGHT_VALID>::PacketView;
+
+      uint16_t weight() const { return this->template le16<Model::WEIGHT_WEIGHT>(); }
+      uint32_t timestamp() const { return this->template le32<Model::WEIGHT_TIME>(); }
+      uint8_t person() const { return this->template u8<Model::WEIGHT_PERSON>(); }
+      SyncKey key() const { return this->ok() ? SyncKey{person(), timestamp()} : SyncKey{0, 0}; }
+    };
+
+    template <typename Model>
+    class BodyView : public PacketView<Model::BODY_LENGTH, Model::BODY_VALID>
+    {
+    public:
+      using PacketView<Model::BODY_LENGTH, Model::BODY_VALID>::PacketView;
+
+      uint32_t timestamp() const { return this->template le32<Model::BODY_TIME>(); }
+      uint8_t person() const { return this->template u8<Model::BODY_PERSON>(); }
+      uint16_t kcal() const { return this->template le16<Model::BODY_KCAL>(); }
+      // first nibble is 0xf
+      uint16_t fat() const { return 0x0fff & this->template le16<Model::BODY_FAT>(); }
+      uint16_t tbw() const { return 0x0fff & this->template le16<Model::BODY_TBW>(); }
+      uint16_t muscle() const { return 0x0fff & this->template le16<Model::BODY_MUSCLE>(); }
+      uint16_t bone() const { return 0x0fff & this->template le16<Model::BODY_BONE>(); }
+      SyncKey key() const { return this->ok() ? SyncKey{person(), timestamp()} : SyncKey{0, 0}; }
+    };
+
+    template <typename Model>
+    Person Person::decode(std::span<const uint8_t> values)
+    {
+      /*
+        decodePerson
+        Handle: 0x25 (Person)
+        Value:
+            Byte  Data                         Value/Return   Interpretation pattern
+            0     fixed byte (validity check)  [0x84]         B (integer, length 1)
+            1     -pad byte-                                  x (pad byte)
+            2     person                       [1..8]         B (integer, length 1)
+            3     -pad byte-                                  x (pad byte)
+            4     gender (1=male, 2=female)    [1|2]          B (integer, length 1)
+            5     age                          [0..255 years] B (integer, length 1)
+            6     size                         [0..255 cm]    B (integer, length 1)
+            7     -pad byte-                                  x (pad byte)
+            8     activity (0=normal, 3=high)  [0|3]          B (integer, length 1)
+            --> Interpretation pattern:                       BxBxBBBxB
+      */
+      Person result;
+      const PersonView<Model> view(values);
+
+      result.valid = view.ok();
+      if (!result.valid)
+        return result;
+      result.person = view.person();
+      result.male = (view.gender() == 1);
+      result.age = view.age();
+      result.size = view.size();
+      result.highActivity = (view.activity() == 3);
+      return result;
+    }
+
+    template <typename Model>
+    Weight Weight::decode(std::span<const uint8_t> values)
+    {
+      /*
+        decodeWeight
+        Handle: 0x1b (Weight)
+        Value:
+            Byte  Data                         Value/Return       Interpretation pattern
+             0    fixed byte (validity check)  [0x1d]             B (integer, length 1)
+             1    weight                       [5,0..180,0 kg]    H (integer, length 2)
+             2    weight
+             3    -pad byte-                                      x (pad byte)
+             4    -pad byte-                                      x (pad byte)
+             5    timestamp                    Unix, date & time  I (integer, length 4)
+             6    timestamp
+             7    timestamp
+             8    timestamp
+             9    -pad byte-                                      x (pad byte)
+            10    -pad byte-                                      x (pad byte)
+            11    -pad byte-                                      x (pad byte)
+            12    -pad byte-                                      x (pad byte)
+            13    person                       [1..8]             B (integer, length 1)
+            --> Interpretation pattern:                           BHxxIxxxxB
+      */
+      Weight result;
+      const WeightView<Model> view(values);
+
+      result.valid = view.ok();
+      if (!result.valid)
+        return result;
+      result.weight = rescale<Model::WEIGHT_SCALE, WEIGHT_SCALE>(view.weight());
+      result.timestamp = sanitize_timestamp(view.timestamp(), Model::EPOCH);
+      result.person = view.person();
+
+      return result;
+    }
+
+    template <typename Model>
+    Body Body::decode(std::span<const uint8_t> values)
+    {
+      /*
+        decodeBody
+        Handle: 0x1e (Body)
+        Value:
+            Byte  Data                          Value/Return       Interpretation pattern
+             0    fixed byte (validity check)   [0x6f]             B (integer, length 1)
+             1    timestamp                     Unix, date & time  I (integer, length 4)
+             2    timestamp
+             3    timestamp
+             4    timestamp
+             5    person                        [1..8]             B (integer, length 1)
+             6    kcal                          [0..65025 Kcal]    H (integer, length 2)
+             7    kcal
+             8    fat (percentage of body fat)  [0..100,0 %]       H (integer, length 2)
+             9    fat (percentage of body fat)
+            10    tbw (percentage of water)     [0..100,0 %]       H (integer, length 2)
+            11    tbw (percentage of water)
+            12    muscle (percentage of muscle) [0..100,0 %]       H (integer, length 2)
+            13    muscle (percentage of muscle)
+            14    bone (bone weight)            [0..100,0 %]       H (integer, length 2)
+            15    bone (bone weight)
+            --> Interpretation pattern:                            BIBBHHHHH
+        Notes: For kcal, fat, tbw, muscle, bone: First nibble = 0xf
+      */
+      Body result;
+      const BodyView<Model> view(values);
+
+      result.valid = view.ok();
+      if (!result.valid)
+        return result;
+      result.timestamp = sanitize_timestamp(view.timestamp(), Model::EPOCH);
+      result.person = view.person();
+      result.kcal = view.kcal();
+      result.fat = rescale<Model::BODY_SCALE, BODY_SCALE>(view.fat());
+      result.tbw = rescale<Model::BODY_SCALE, BODY_SCALE>(view.tbw());
+      result.muscle = rescale<Model::BODY_SCALE, BODY_SCALE>(view.muscle());
+      result.bone = rescale<Model::BODY_SCALE, BODY_SCALE>(view.bone());
+
+      return result;
+    }
+  } // namespace medisana_bs444
+} // namespace esphome
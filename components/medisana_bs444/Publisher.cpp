@@ -0,0 +1,93 @@
+#include <cmath>
+#include <cstring>
+
+#include "Publisher.h"
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    static bool within(float a, float b, float deadband)
+    {
+      if (std::isnan(a) || std::isnan(b))
+        return std::isnan(a) && std::isnan(b);
+      return fabsf(a - b) <= deadband;
+    }
+
+    void Publisher::publish(sensor::Sensor *sensor, float value, float deadband, bool force)
+    {
+      if (sensor == nullptr)
+        return;
+      if (auto *queued = this->find_(sensor))
+      {
+        queued->value = value;
+        return;
+      }
+      // the raw state is the value passed to the last publish_state()
+      if (!force && sensor->has_state() && within(sensor->get_raw_state(), value, deadband))
+        return;
+      this->enqueue_(sensor, false, value);
+    }
+
+#ifdef USE_BINARY_SENSOR
+    void Publisher::publish(binary_sensor::BinarySensor *sensor, bool value)
+    {
+      if (sensor == nullptr)
+        return;
+      if (auto *queued = this->find_(sensor))
+      {
+        queued->value = value;
+        return;
+      }
+      if (sensor->has_state() && (sensor->state == value))
+        return;
+      this->enqueue_(sensor, true, value);
+    }
+#endif
+
+    void Publisher::loop()
+    {
+      const size_t n = this->count_ < PER_LOOP ? this->count_ : PER_LOOP;
+      if (n == 0)
+        return;
+      for (size_t i = 0; i < n; i++)
+        send_(this->queue_[i]);
+      memmove(&this->queue_[0], &this->queue_[n], (this->count_ - n) * sizeof(Entry));
+      this->count_ -= n;
+    }
+
+    Publisher::Entry *Publisher::find_(const void *entity)
+    {
+      for (size_t i = 0; i < this->count_; i++)
+      {
+        if (this->queue_[i].entity == entity)
+          return &this->queue_[i];
+      }
+      return nullptr;
+    }
+
+    void Publisher::enqueue_(void *entity, bool binary, float value)
+    {
+      const Entry entry{entity, binary, value};
+      // more entities than slots: better late than never, publish right away
+      if (this->count_ == CAPACITY)
+      {
+        send_(entry);
+        return;
+      }
+      this->queue_[this->count_++] = entry;
+    }
+
+    void Publisher::send_(const Entry &entry)
+    {
+#ifdef USE_BINARY_SENSOR
+      if (entry.binary)
+      {
+        static_cast<binary_sensor::BinarySensor *>(entry.entity)->publish_state(entry.value != 0);
+        return;
+      }
+#endif
+      static_cast<sensor::Sensor *>(entry.entity)->publish_state(entry.value);
+    }
+  } // namespace medisana_bs444
+} // namespace esphome
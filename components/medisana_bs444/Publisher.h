@@ -0,0 +1,55 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+#include "esphome/components/sensor/sensor.h"
+#ifdef USE_BINARY_SENSOR
+#include "esphome/components/binary_sensor/binary_sensor.h"
+#endif
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    // Publishes entity states from loop(), a few per iteration instead of all
+    // at once at the end of a session, and only when they differ from what
+    // was published last by more than the deadband, or when forced for a new
+    // measurement. Queued states of the same entity are coalesced, only the
+    // newest is published. Every entity state of the component goes through
+    // here.
+    class Publisher
+    {
+    public:
+      static constexpr size_t CAPACITY = 48;
+      static constexpr size_t PER_LOOP = 2;
+
+      void publish(sensor::Sensor *sensor, float value, float deadband = 0, bool force = false);
+#ifdef USE_BINARY_SENSOR
+      void publish(binary_sensor::BinarySensor *sensor, bool value);
+#endif
+
+      // publishes up to PER_LOOP queued states
+      void loop();
+      size_t pending() const { return count_; }
+
+    private:
+      struct Entry
+      {
+        void *entity;
+        bool binary;
+        float value;
+      };
+
+      Entry *find_(const void *entity);
+      void enqueue_(void *entity, bool binary, float value);
+      static void send_(const Entry &entry);
+
+      // FIFO, oldest first
+      std::array<Entry, CAPACITY> queue_;
+      size_t count_ = 0;
+    };
+  } // namespace medisana_bs444
+} // namespace esphome
@@ -1,52 +1,45 @@
-#include "esphome.h"
-#ifdef USE_TIME
-#include "esphome/core/time.h"
-#endif
+#include <cstdio>
+#include <limits>
+
 #include "Scale.h"
 
 namespace esphome
 {
   namespace medisana_bs444
   {
-
-    const esp32_ble::ESPBTUUID Serv_SCALE = esp32_ble::ESPBTUUID::from_raw("000078b2-0000-1000-8000-00805f9b34fb"); // the service
-
-    const esp32_ble::ESPBTUUID Char_person = esp32_ble::ESPBTUUID::from_raw("00008a82-0000-1000-8000-00805f9b34fb"); // person data handle 22
-    const esp32_ble::ESPBTUUID Char_weight = esp32_ble::ESPBTUUID::from_raw("00008a21-0000-1000-8000-00805f9b34fb"); // weight data handle 25
-    const esp32_ble::ESPBTUUID Char_body = esp32_ble::ESPBTUUID::from_raw("00008a22-0000-1000-8000-00805f9b34fb");   // body data handle 28
-
-    const esp32_ble::ESPBTUUID Char_command = esp32_ble::ESPBTUUID::from_raw("00008a81-0000-1000-8000-00805f9b34fb"); // command register handle 31
-
-    // timeoffset used by BS410 and BS444
-    const time_t time_offset = 1262304000;
-
     /*******************************************************************************/
-    std::string timeAsString(time_t time)
-    {
-      return ESPTime::from_epoch_local(time).strftime("%Y-%m-%dT%H:%M:%S");
-    }
-
-    time_t sanitize_timestamp(time_t timestamp, bool use_timeoffset)
+    const char *TimeFormatter::format(time_t time)
     {
-      time_t retTS = 0;
-      if (use_timeoffset)
+      // DST and zone offsets change on hour boundaries, so within the cached
+      // hour only minutes and seconds differ
+      if (hourStart_ < 0 || time < hourStart_ || time >= hourStart_ + 3600)
       {
-        // Fail-safe: The timestamp will only be sanitized if it will be
-        // below below the maximum unix timestamp (2147483647).
-        if (timestamp + time_offset < std::numeric_limits<time_t>::max())
-          retTS = timestamp + time_offset;
-        else
-          retTS = timestamp;
+        // local time, the time component keeps TZ up to date on the device
+        struct tm tm;
+        if (localtime_r(&time, &tm) == nullptr || strftime(buffer_, sizeof(buffer_), "%Y-%m-%dT%H:", &tm) != 14)
+        {
+          hourStart_ = -1;
+          return "invalid";
+        }
+        hourStart_ = time - (tm.tm_min * 60 + tm.tm_sec);
       }
-      else
-        retTS = timestamp;
-
-      // If the non-sanitized timestamp is already above the maximum unix timestamp,
-      // 0 will be taken instead.
-      if (timestamp >= std::numeric_limits<time_t>::max())
-        retTS = 0;
+      const unsigned seconds = time - hourStart_;
+      buffer_[14] = '0' + seconds / 600;
+      buffer_[15] = '0' + (seconds / 60) % 10;
+      buffer_[16] = ':';
+      buffer_[17] = '0' + (seconds % 60) / 10;
+      buffer_[18] = '0' + seconds % 10;
+      buffer_[19] = '\0';
+      return buffer_;
+    }
 
-      return retTS;
+    time_t sanitize_timestamp(uint32_t timestamp, time_t epoch)
+    {
+      // Fail-safe: The timestamp will only be sanitized if it will be
+      // below below the maximum unix timestamp.
+      if (time_t(timestamp) > std::numeric_limits<time_t>::max() - epoch)
+        return timestamp;
+      return timestamp + epoch;
     }
 
     void convertTimestampToLittleEndian(time_t timestamp, uint8_t *byteArray)
@@ -58,161 +51,43 @@ namespace esphome
       byteArray[3] = static_cast<uint8_t>((timestamp >> 24) & 0xFF);
     }
 
-    std::string Person::toString() const
+    const char *Person::format(char *buffer, size_t size) const
     {
-      std::stringstream str;
       if (valid)
-      {
-        // Print the date and time in a user-readable format
-        str << "Person: " << person;
-        str << "; gender: " << (male ? "male" : "female");
-        str << "; age: " << age;
-        str << "; size: " << size;
-        str << "; activity: " << (highActivity ? "high" : "normal");
-      }
+        snprintf(buffer, size, "Person: %u; gender: %s; age: %u; size: %u; activity: %s", person,
+                 (male ? "male" : "female"), age, this->size, (highActivity ? "high" : "normal"));
       else
-        str << "invalid";
-      return str.str();
-    }
-
-    Person Person::decode(const uint8_t *values)
-    {
-      /*
-        decodePerson
-        Handle: 0x25 (Person)
-        Value:
-            Byte  Data                         Value/Return   Interpretation pattern
-            0     fixed byte (validity check)  [0x84]         B (integer, length 1)
-            1     -pad byte-                                  x (pad byte)
-            2     person                       [1..8]         B (integer, length 1)
-            3     -pad byte-                                  x (pad byte)
-            4     gender (1=male, 2=female)    [1|2]          B (integer, length 1)
-            5     age                          [0..255 years] B (integer, length 1)
-            6     size                         [0..255 cm]    B (integer, length 1)
-            7     -pad byte-                                  x (pad byte)
-            8     activity (0=normal, 3=high)  [0|3]          B (integer, length 1)
-            --> Interpretation pattern:                       BxBxBBBxB
-      */
-      Person result;
-
-      result.valid = (values[0] == 0x84);
-      result.person = values[2];
-      result.male = (values[4] == 1);
-      result.age = values[5];
-      result.size = values[6] / 100.0;
-      result.highActivity = (values[8] == 3);
-      return result;
+        snprintf(buffer, size, "invalid");
+      return buffer;
     }
 
-    std::string Weight::toString(const Person &person) const
+    const char *Weight::format(char *buffer, size_t size, TimeFormatter &time, const Person &person) const
     {
-      std::stringstream str;
       if (valid)
       {
-        str << "Person: " << this->person;
-        str << "; Time:" << timeAsString(timestamp);
-        str << "; weight: " << weight;
-        if (person.valid && person.size > 0)
+        int len = snprintf(buffer, size, "Person: %u; Time:%s; weight: %u.%02u", this->person, time.format(timestamp),
+                           weight / WEIGHT_SCALE, weight % WEIGHT_SCALE);
+        if (person.valid && person.size > 0 && len >= 0 && static_cast<size_t>(len) < size)
         {
-          // Normale BMI formule: gewicht / lengte^2
-          // Nieuwe BMI formule: 1,3 * gewicht / lengte^2,5
-          str << "; bmi: " << (weight / (person.size * person.size));
+          const unsigned value = bmi(weight, person.size);
+          snprintf(buffer + len, size - len, "; bmi: %u.%u", value / BMI_SCALE, value % BMI_SCALE);
         }
       }
       else
-        str << "invalid";
-      return str.str();
-    }
-
-    Weight Weight::decode(const uint8_t *values, bool useTimeoffset)
-    {
-      /*
-        decodeWeight
-        Handle: 0x1b (Weight)
-        Value:
-            Byte  Data                         Value/Return       Interpretation pattern
-             0    fixed byte (validity check)  [0x1d]             B (integer, length 1)
-             1    weight                       [5,0..180,0 kg]    H (integer, length 2)
-             2    weight
-             3    -pad byte-                                      x (pad byte)
-             4    -pad byte-                                      x (pad byte)
-             5    timestamp                    Unix, date & time  I (integer, length 4)
-             6    timestamp
-             7    timestamp
-             8    timestamp
-             9    -pad byte-                                      x (pad byte)
-            10    -pad byte-                                      x (pad byte)
-            11    -pad byte-                                      x (pad byte)
-            12    -pad byte-                                      x (pad byte)
-            13    person                       [1..8]             B (integer, length 1)
-            --> Interpretation pattern:                           BHxxIxxxxB
-      */
-      Weight result;
-
-      result.valid = (values[0] == 0x1d);
-      result.weight = ((values[2] << 8) | values[1]) / 100.0;
-      result.timestamp = sanitize_timestamp((values[8] << 24) | (values[7] << 16) | (values[6] << 8) | values[5], useTimeoffset);
-      result.person = values[13];
-
-      return result;
+        snprintf(buffer, size, "invalid");
+      return buffer;
     }
 
-    std::string Body::toString() const
+    const char *Body::format(char *buffer, size_t size, TimeFormatter &time) const
     {
-      std::stringstream str;
       if (valid)
-      {
-        str << "Person: " << person;
-        str << "; Time:" << timeAsString(timestamp);
-        str << "; kcal: " << kcal;
-        str << "; fat: " << fat;
-        str << "; tbw: " << tbw;
-        str << "; muscle: " << muscle;
-        str << "; bone: " << bone;
-      }
+        snprintf(buffer, size, "Person: %u; Time:%s; kcal: %u; fat: %u.%u; tbw: %u.%u; muscle: %u.%u; bone: %u.%u", person,
+                 time.format(timestamp), kcal, fat / BODY_SCALE, fat % BODY_SCALE, tbw / BODY_SCALE, tbw % BODY_SCALE,
+                 muscle / BODY_SCALE, muscle % BODY_SCALE, bone / BODY_SCALE, bone % BODY_SCALE);
       else
-        str << "invalid";
-      return str.str();
+        snprintf(buffer, size, "invalid");
+      return buffer;
     }
 
-    Body Body::decode(const uint8_t *values, bool useTimeoffset)
-    {
-      /*
-        decodeBody
-        Handle: 0x1e (Body)
-        Value:
-            Byte  Data                          Value/Return       Interpretation pattern
-             0    fixed byte (validity check)   [0x6f]             B (integer, length 1)
-             1    timestamp                     Unix, date & time  I (integer, length 4)
-             2    timestamp
-             3    timestamp
-             4    timestamp
-             5    person                        [1..8]             B (integer, length 1)
-             6    kcal                          [0..65025 Kcal]    H (integer, length 2)
-             7    kcal
-             8    fat (percentage of body fat)  [0..100,0 %]       H (integer, length 2)
-             9    fat (percentage of body fat)
-            10    tbw (percentage of water)     [0..100,0 %]       H (integer, length 2)
-            11    tbw (percentage of water)
-            12    muscle (percentage of muscle) [0..100,0 %]       H (integer, length 2)
-            13    muscle (percentage of muscle)
-            14    bone (bone weight)            [0..100,0 %]       H (integer, length 2)
-            15    bone (bone weight)
-            --> Interpretation pattern:                            BIBBHHHHH
-        Notes: For kcal, fat, tbw, muscle, bone: First nibble = 0xf
-      */
-      Body result;
-
-      result.valid = (values[0] == 0x6f);
-      result.timestamp = sanitize_timestamp((values[4] << 24) | (values[3] << 16) | (values[2] << 8) | values[1], useTimeoffset);
-      result.person = (values[5]);
-      result.kcal = (values[7] << 8 | values[6]);
-      result.fat = (0x0fff & (values[9] << 8 | values[8])) / 10.0;
-      result.tbw = (0x0fff & (values[11] << 8 | values[10])) / 10.0;
-      result.muscle = (0x0fff & (values[13] << 8 | values[12])) / 10.0;
-      result.bone = (0x0fff & (values[15] << 8 | values[14])) / 10.0;
-
-      return result;
-    }
   } // namespace medisana_bs444
 } // namespace esphome
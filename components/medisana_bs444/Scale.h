@@ -1,36 +1,60 @@
 #pragma once
 
-#include <iostream>
-#include <sstream>
+#include <compare>
+#include <cstdint>
+#include <cstddef>
+#include <ctime>
+#include <span>
+#include <sys/types.h>
 
-#include "esphome/components/esp32_ble/ble_uuid.h"
+// Protocol layer of the scale: plain C++, no ESPHome or ESP-IDF headers so it
+// can be compiled and exercised on a host as well.
 
 namespace esphome
 {
   namespace medisana_bs444
   {
 
-    extern const esp32_ble::ESPBTUUID Serv_SCALE; // the service
-
-    extern const esp32_ble::ESPBTUUID Char_person; // person data handle 22
-    extern const esp32_ble::ESPBTUUID Char_weight; // weight data handle 25
-    extern const esp32_ble::ESPBTUUID Char_body;   // body data handle 28
-
-    extern const esp32_ble::ESPBTUUID Char_command; // command register handle 31
-
     //   On some scales (e.g. BS410 and BS444, maybe others as well), time=0
     //   equals 1/1/2010. However, goal is to have unix-timestamps. Thus, the
     //   function converts the "scale-timestamp" to unix-timestamp by adding
-    //   the time-offset (most scales: 1262304000 = 01.01.2010) to the timestamp.
+    //   the epoch of the model (see Protocol.h) to the timestamp.
+    time_t sanitize_timestamp(uint32_t timestamp, time_t epoch);
 
-    // Assuming time_offset is a constant defined somewhere in the code
-    extern const time_t time_offset;
+    void convertTimestampToLittleEndian(time_t timestamp, uint8_t *byteArray);
 
-    time_t sanitize_timestamp(time_t timestamp, bool useTimeoffset);
+    // size of the buffer the format() functions below expect
+    static constexpr size_t FORMAT_BUFFER_SIZE = 128;
 
-    void convertTimestampToLittleEndian(time_t timestamp, uint8_t *byteArray);
+    // Formats timestamps as local time without touching the heap. A history
+    // dump holds 30 records taken minutes to days apart, so the broken down
+    // local time of the last hour is cached and only minutes/seconds are
+    // recomputed. reset() drops the cache, call it once per session so a
+    // timezone change is picked up.
+    class TimeFormatter
+    {
+    public:
+      const char *format(time_t time);
+      void reset() { hourStart_ = -1; }
 
-    std::string timeAsString(time_t time);
+    private:
+      time_t hourStart_ = -1;
+      char buffer_[20] = {}; // "YYYY-MM-DDTHH:" is kept for the cached hour
+    };
+
+    // Decoded values are exact integers in the unit the scale sends them,
+    // convert with the scale factors below only where a float is needed.
+    static constexpr uint32_t WEIGHT_SCALE = 100; // Weight::weight in 1/100 kg
+    static constexpr uint32_t BODY_SCALE = 10;    // Body::fat/tbw/muscle in 1/10 %, bone in 1/10 kg
+    static constexpr uint32_t BMI_SCALE = 10;     // bmi() in 1/10 kg/m2
+
+    // BMI of weight (1/100 kg) at size (cm), rounded, 0 if size is unknown
+    constexpr uint16_t bmi(uint32_t weight, uint32_t size)
+    {
+      // Normale BMI formule: gewicht / lengte^2
+      // Nieuwe BMI formule: 1,3 * gewicht / lengte^2,5
+      return size ? (weight * (10000 / WEIGHT_SCALE) * BMI_SCALE + size * size / 2) / (size * size) : 0;
+    }
 
     class Person
     {
@@ -39,14 +63,16 @@ namespace esphome
 
     public:
       bool valid = false;
-      u_int32_t person = 255;
-      bool male;
-      u_int32_t age;
-      double size;
-      bool highActivity;
-
-      std::string toString() const;
-      static Person decode(const uint8_t *values);
+      uint8_t person = 255;
+      bool male = false;
+      uint8_t age = 0;
+      uint8_t size = 0; // cm
+      bool highActivity = false;
+
+      const char *format(char *buffer, size_t size) const;
+      // per model, see Protocol.h
+      template <typename Model>
+      static Person decode(std::span<const uint8_t> values);
     };
 
     class Weight
@@ -55,13 +81,14 @@ namespace esphome
       auto operator<=>(const Weight &) const = default;
 
     public:
-      bool valid = false;
       time_t timestamp = 0;
-      u_int32_t person;
-      double weight;
+      bool valid = false;
+      uint8_t person = 0;
+      uint16_t weight = 0; // 1/WEIGHT_SCALE kg
 
-      std::string toString(const Person &person = Person()) const;
-      static Weight decode(const uint8_t *values, bool useTimeoffset);
+      const char *format(char *buffer, size_t size, TimeFormatter &time, const Person &person = Person()) const;
+      template <typename Model>
+      static Weight decode(std::span<const uint8_t> values);
     };
 
     class Body
@@ -70,16 +97,17 @@ namespace esphome
       auto operator<=>(const Body &) const = default;
 
     public:
-      bool valid = false;
       time_t timestamp = 0;
-      u_int32_t person;
-      u_int32_t kcal;
-      double fat;
-      double tbw;
-      double muscle;
-      double bone;
-      std::string toString() const;
-      static Body decode(const uint8_t *values, bool useTimeoffset);
+      bool valid = false;
+      uint8_t person = 0;
+      uint16_t kcal = 0;
+      uint16_t fat = 0;    // 1/BODY_SCALE %
+      uint16_t tbw = 0;    // 1/BODY_SCALE %
+      uint16_t muscle = 0; // 1/BODY_SCALE %
+      uint16_t bone = 0;   // 1/BODY_SCALE kg
+      const char *format(char *buffer, size_t size, TimeFormatter &time) const;
+      template <typename Model>
+      static Body decode(std::span<const uint8_t> values);
     };
   } // namespace medisana_bs444
 } // namespace esphome
@@ -0,0 +1,60 @@
+#include <cstring>
+
+#include "SessionCapture.h"
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    void SessionCapture::clear()
+    {
+      size_ = 0;
+      last_ = 0;
+      truncated_ = false;
+    }
+
+    bool SessionCapture::record(uint8_t event, uint8_t status, uint16_t handle, const uint8_t *data, size_t len, uint32_t now)
+    {
+      if (len > 0xff)
+        len = 0xff;
+      if (size_ + HEADER_SIZE + len > CAPACITY)
+      {
+        truncated_ = true;
+        return false;
+      }
+      const uint32_t delta = (size_ == 0) ? 0 : now - last_;
+      const uint16_t delta16 = delta > 0xffff ? 0xffff : delta;
+      last_ = now;
+
+      uint8_t *p = buffer_ + size_;
+      p[0] = event;
+      p[1] = status;
+      p[2] = delta16 & 0xff;
+      p[3] = delta16 >> 8;
+      p[4] = handle & 0xff;
+      p[5] = handle >> 8;
+      p[6] = len;
+      if (len)
+        memcpy(p + HEADER_SIZE, data, len);
+      size_ += HEADER_SIZE + len;
+      return true;
+    }
+
+    bool SessionCapture::next(const uint8_t *log, size_t size, size_t &offset, Event &event)
+    {
+      if (offset + HEADER_SIZE > size)
+        return false;
+      const uint8_t *p = log + offset;
+      if (offset + HEADER_SIZE + p[6] > size)
+        return false;
+      event.event = p[0];
+      event.status = p[1];
+      event.delta = p[2] | (p[3] << 8);
+      event.handle = p[4] | (p[5] << 8);
+      event.len = p[6];
+      event.data = p + HEADER_SIZE;
+      offset += HEADER_SIZE + event.len;
+      return true;
+    }
+  } // namespace medisana_bs444
+} // namespace esphome
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    // Binary log of the GATTC events of one session, to replay a session
+    // off-device. Every event is stored as
+    //
+    //   Byte  Data
+    //    0    esp_gattc_cb_event_t
+    //    1    status (disconnect: reason)
+    //    2-3  ms since the previous event, little endian, saturates at 0xffff
+    //    4-5  handle, little endian (0 if the event has none)
+    //    6    payload length n
+    //    7..  n payload bytes (notify and read only)
+    class SessionCapture
+    {
+    public:
+      static constexpr size_t CAPACITY = 4096;
+      static constexpr size_t HEADER_SIZE = 7;
+
+      // the esp_gattc_cb_event_t values of ESP-IDF, for the tools that read
+      // or write a log without ESP-IDF
+      enum Gattc : uint8_t
+      {
+        OPEN = 2,
+        READ_CHAR = 3,
+        WRITE_CHAR = 4,
+        SEARCH_CMPL = 6,
+        WRITE_DESCR = 9,
+        NOTIFY = 10,
+        CFG_MTU = 18,
+        REG_FOR_NOTIFY = 38,
+        DISCONNECT = 41,
+      };
+
+      struct Event
+      {
+        uint8_t event;
+        uint8_t status;
+        uint16_t delta;
+        uint16_t handle;
+        uint8_t len;
+        const uint8_t *data;
+      };
+
+      void clear();
+      // false (and marked truncated) when the log is full
+      bool record(uint8_t event, uint8_t status, uint16_t handle, const uint8_t *data, size_t len, uint32_t now);
+
+      const uint8_t *data() const { return buffer_; }
+      size_t size() const { return size_; }
+      bool truncated() const { return truncated_; }
+
+      // walks a captured log, returns false at the end or on a corrupt record
+      static bool next(const uint8_t *log, size_t size, size_t &offset, Event &event);
+
+    private:
+      uint8_t buffer_[CAPACITY];
+      size_t size_ = 0;
+      uint32_t last_ = 0;
+      bool truncated_ = false;
+    };
+  } // namespace medisana_bs444
+} // namespace esphome
@@ -0,0 +1,124 @@
+#include "SessionScheduler.h"
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    SessionScheduler &SessionScheduler::instance()
+    {
+      static SessionScheduler scheduler;
+      return scheduler;
+    }
+
+    uint8_t SessionScheduler::add_scale()
+    {
+      scales_.emplace_back();
+      return scales_.size() - 1;
+    }
+
+    void SessionScheduler::advertising(uint8_t scale, uint32_t now)
+    {
+      auto &s = scales_[scale];
+      // the scale keeps advertising for a while after a session, that is not a new wake up
+      const bool after_session = (s.last_session != 0) && (now - s.last_session < ADVERTISING_GAP);
+      if ((s.state == State::IDLE) && !after_session)
+      {
+        s.state = State::WAITING;
+        s.first_seen = now;
+      }
+      s.last_seen = now;
+    }
+
+    void SessionScheduler::session_started(uint8_t scale, uint32_t now)
+    {
+      auto &s = scales_[scale];
+      s.state = State::ACTIVE;
+      s.granted = false;
+      s.last_seen = now;
+    }
+
+    void SessionScheduler::session_ended(uint8_t scale, uint32_t now)
+    {
+      auto &s = scales_[scale];
+      s.state = State::IDLE;
+      s.last_session = now;
+    }
+
+    void SessionScheduler::update(uint32_t now)
+    {
+      uint8_t busy = 0;
+      for (auto &s : scales_)
+      {
+        if ((s.state == State::WAITING) && (now - s.last_seen > ADVERTISING_GAP))
+        {
+          // back to sleep before it got a session
+          s.state = State::IDLE;
+          s.granted = false;
+          s.missed++;
+        }
+        if (s.granted && (now - s.granted_at > GRANT_TIMEOUT))
+        {
+          // the connection did not open, let the other waiting scales go first
+          s.granted = false;
+          s.first_seen = 0;
+        }
+        if ((s.state == State::ACTIVE) || s.granted)
+          busy++;
+      }
+
+      // free slots go to the waiting scales that woke up last
+      for (uint8_t free = busy < max_sessions_ ? max_sessions_ - busy : 0; free > 0; free--)
+      {
+        Scale *next = nullptr;
+        for (auto &s : scales_)
+        {
+          if ((s.state == State::WAITING) && !s.granted && ((next == nullptr) || (s.first_seen > next->first_seen)))
+            next = &s;
+        }
+        if (next == nullptr)
+          break;
+        next->granted = true;
+        next->granted_at = now;
+      }
+    }
+
+    bool SessionScheduler::may_connect(uint8_t scale) const
+    {
+      // nothing to arbitrate when every scale can have a slot
+      if (scales_.size() <= max_sessions_)
+        return true;
+      const auto &s = scales_[scale];
+      return (s.state == State::ACTIVE) || s.granted;
+    }
+
+    bool SessionScheduler::any_likely() const
+    {
+      for (const auto &s : scales_)
+      {
+        if (s.likely)
+          return true;
+      }
+      return false;
+    }
+
+    void SessionScheduler::set_scan_windows(uint32_t window, uint32_t floor)
+    {
+      scan_window_ = window;
+      if (floor > scan_window_floor_)
+        scan_window_floor_ = floor;
+      // the tracker starts with its own window
+      applied_window_ = window;
+    }
+
+    bool SessionScheduler::scan_window_changed()
+    {
+      if (scan_window_ == 0)
+        return false;
+      const uint32_t window = scan_window();
+      if (window == applied_window_)
+        return false;
+      applied_window_ = window;
+      return true;
+    }
+  } // namespace medisana_bs444
+} // namespace esphome
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    // Decides which scales may connect when one node serves several of them.
+    // A scale that starts advertising asks for a session; when all session
+    // slots are busy it waits, the scale that woke up last is served first as
+    // it has the most of its awake window left. A slot handed to a scale stays
+    // its own until the connection opens or the grant times out. A scale that
+    // stops advertising before it got a session counts as a missed session.
+    //
+    // Times are in milliseconds, as returned by millis().
+    class SessionScheduler
+    {
+    public:
+      // a scale that is not seen for this long went back to sleep
+      static constexpr uint32_t ADVERTISING_GAP = 10000;
+      // a granted scale that did not connect in this time hands its slot on
+      static constexpr uint32_t GRANT_TIMEOUT = 10000;
+      // connections ESPHome's BLE stack allows by default
+      static constexpr uint8_t DEFAULT_MAX_SESSIONS = 3;
+
+      // shared by all scales on the node
+      static SessionScheduler &instance();
+
+      void set_max_sessions(uint8_t max_sessions) { max_sessions_ = max_sessions; }
+      uint8_t get_max_sessions() const { return max_sessions_; }
+
+      // returns the id to use in the calls below
+      uint8_t add_scale();
+
+      void advertising(uint8_t scale, uint32_t now);
+      void session_started(uint8_t scale, uint32_t now);
+      void session_ended(uint8_t scale, uint32_t now);
+
+      // expire scales that stopped advertising and hand out free slots
+      void update(uint32_t now);
+
+      // whether the client of the scale may (stay) connect(ed)
+      bool may_connect(uint8_t scale) const;
+      uint32_t missed(uint8_t scale) const { return scales_[scale].missed; }
+
+      // whether a scale is likely to wake up now, the node scans at full
+      // duty while any of its scales is
+      void set_likely(uint8_t scale, bool likely) { scales_[scale].likely = likely; }
+      bool any_likely() const;
+
+      // the tracker's scan window and the one used while no scale is likely,
+      // in units of 0.625 ms; the widest floor of the scales counts
+      void set_scan_windows(uint32_t window, uint32_t floor);
+      // the window the node scans with now
+      uint32_t scan_window() const { return any_likely() ? scan_window_ : scan_window_floor_; }
+      // true once for every change of scan_window(), the caller applies it
+      bool scan_window_changed();
+
+    private:
+      enum class State : uint8_t
+      {
+        IDLE,
+        WAITING,
+        ACTIVE,
+      };
+
+      struct Scale
+      {
+        State state = State::IDLE;
+        bool granted = false;
+        uint32_t granted_at = 0;
+        uint32_t first_seen = 0; // start of the current advertising burst
+        uint32_t last_seen = 0;
+        uint32_t last_session = 0; // end of the last session
+        uint32_t missed = 0;
+        bool likely = true;
+      };
+
+      std::vector<Scale> scales_;
+      uint8_t max_sessions_ = DEFAULT_MAX_SESSIONS;
+      // 0: the adaptive scan is off, the tracker's settings stay as they are
+      uint32_t scan_window_ = 0;
+      uint32_t scan_window_floor_ = 0;
+      uint32_t applied_window_ = 0;
+    };
+  } // namespace medisana_bs444
+} // namespace esphome
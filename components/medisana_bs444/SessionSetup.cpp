@@ -0,0 +1,71 @@
+#include "SessionSetup.h"
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    void SessionSetup::start(uint16_t person, uint16_t weight, uint16_t body, uint16_t command)
+    {
+      uint8_t i = 0;
+      for (auto handle : {person, weight, body})
+      {
+        operations_[i++] = Operation{.kind = Action::REGISTER, .handle = handle};
+        operations_[i++] = Operation{.kind = Action::WRITE_CCCD, .handle = uint16_t(handle + 1)};
+      }
+      operations_[i] = Operation{.kind = Action::WRITE_COMMAND, .handle = command};
+      state_ = State::ENABLING;
+    }
+
+    SessionSetup::Action SessionSetup::next(uint32_t now)
+    {
+      while (this->active())
+      {
+        bool done = true;
+        for (auto *op = this->stage_begin_(); op != this->stage_end_(); op++)
+        {
+          if (op->done)
+            continue;
+          done = false;
+          if (op->pending && (now - op->sent <= STEP_TIMEOUT))
+            continue;
+          // not sent yet, failed or timed out
+          if (op->attempts == MAX_ATTEMPTS)
+          {
+            state_ = State::FAILED;
+            return Action();
+          }
+          op->pending = true;
+          op->sent = now;
+          return Action{.kind = op->kind, .handle = op->handle, .retry = op->attempts++ > 0};
+        }
+        if (!done)
+          break;
+        state_ = (state_ == State::ENABLING) ? State::STARTING : State::DONE;
+      }
+      return Action();
+    }
+
+    void SessionSetup::confirm_(Action::Kind kind, uint16_t handle, bool ok)
+    {
+      if (!this->active())
+        return;
+      for (auto *op = this->stage_begin_(); op != this->stage_end_(); op++)
+      {
+        // a late confirmation of an earlier attempt counts as well
+        if ((op->kind != kind) || (op->handle != handle) || op->done)
+          continue;
+        op->done = ok;
+        op->pending = false;
+        return;
+      }
+    }
+
+    void SessionSetup::registered(uint16_t handle, bool ok) { this->confirm_(Action::REGISTER, handle, ok); }
+
+    void SessionSetup::written(uint16_t handle, bool ok)
+    {
+      // descriptor writes of both stages come in as the same event
+      this->confirm_(state_ == State::STARTING ? Action::WRITE_COMMAND : Action::WRITE_CCCD, handle, ok);
+    }
+  } // namespace medisana_bs444
+} // namespace esphome
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    // The GATT operations that prepare a session, in two stages:
+    //
+    //   1. register for notifications and enable the indications (CCCD write)
+    //      of person, weight and body, all six at once
+    //   2. write the command that starts the dump, only once every operation
+    //      of stage 1 is confirmed
+    //
+    // The engine does no I/O. next() hands out the operations to send, the
+    // confirmations are passed back in. An operation that fails, or is not
+    // confirmed within STEP_TIMEOUT, is sent again, at most MAX_ATTEMPTS times
+    // in all; after that the setup has failed.
+    //
+    // Times are in milliseconds, as returned by millis().
+    class SessionSetup
+    {
+    public:
+      static constexpr uint32_t STEP_TIMEOUT = 2000;
+      static constexpr uint8_t MAX_ATTEMPTS = 3;
+
+      enum class State : uint8_t
+      {
+        IDLE,
+        ENABLING,
+        STARTING,
+        DONE,
+        FAILED,
+      };
+
+      struct Action
+      {
+        enum Kind : uint8_t
+        {
+          NONE,
+          REGISTER,      // esp_ble_gattc_register_for_notify
+          WRITE_CCCD,    // turn the indications on
+          WRITE_COMMAND, // start the dump
+        };
+        Kind kind = NONE;
+        uint16_t handle = 0; // characteristic, descriptor for WRITE_CCCD
+        bool retry = false;
+
+        explicit operator bool() const { return kind != NONE; }
+      };
+
+      // the CCCD of a characteristic follows it
+      void start(uint16_t person, uint16_t weight, uint16_t body, uint16_t command);
+      void stop() { state_ = State::IDLE; }
+
+      // the next operation to send, or NONE when waiting for confirmations
+      Action next(uint32_t now);
+      void registered(uint16_t handle, bool ok);
+      void written(uint16_t handle, bool ok);
+
+      State state() const { return state_; }
+      bool active() const { return (state_ == State::ENABLING) || (state_ == State::STARTING); }
+      // stage 1 is done, confirmed by the scale
+      bool enabled() const { return (state_ == State::STARTING) || (state_ == State::DONE); }
+
+    private:
+      struct Operation
+      {
+        Action::Kind kind = Action::NONE;
+        uint16_t handle = 0;
+        uint8_t attempts = 0;
+        bool pending = false; // sent, not confirmed yet
+        bool done = false;
+        uint32_t sent = 0;
+      };
+
+      static constexpr size_t ENABLE_OPERATIONS = 6;
+
+      void confirm_(Action::Kind kind, uint16_t handle, bool ok);
+      Operation *stage_begin_() { return state_ == State::STARTING ? &operations_[ENABLE_OPERATIONS] : &operations_[0]; }
+      Operation *stage_end_() { return state_ == State::STARTING ? operations_.end() : &operations_[ENABLE_OPERATIONS]; }
+
+      State state_ = State::IDLE;
+      std::array<Operation, ENABLE_OPERATIONS + 1> operations_;
+    };
+  } // namespace medisana_bs444
+} // namespace esphome
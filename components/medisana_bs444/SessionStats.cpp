@@ -0,0 +1,196 @@
+#include "SessionStats.h"
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    void SessionStats::Summary::add(uint32_t value)
+    {
+      if ((count == 0) || (value < min))
+        min = value;
+      if ((count == 0) || (value > max))
+        max = value;
+      sum += value;
+      count++;
+    }
+
+    void SessionStats::advertised(uint32_t now)
+    {
+      // the same wake up as the scheduler sees it
+      if ((advertised_ == 0) || (now - last_advertisement_ > SessionScheduler::ADVERTISING_GAP))
+        advertised_ = now;
+      last_advertisement_ = now;
+    }
+
+    void SessionStats::opened(uint32_t now)
+    {
+      starting_ = true;
+      next_opened_ = now;
+      // the scale may not have been seen advertising (passive scan missed it)
+      next_connected_ = advertised_ != 0;
+      next_connect_ = now - advertised_;
+      // the counters still belong to the previous session until loop() is done with it
+      if (!open_)
+        this->start_();
+    }
+
+    void SessionStats::start()
+    {
+      if (starting_)
+        this->start_();
+    }
+
+    void SessionStats::start_()
+    {
+      starting_ = false;
+      open_ = true;
+      opened_ = next_opened_;
+      for (uint8_t i = 0; i < PHASES; i++)
+        reached_[i] = false;
+      for (uint8_t i = 0; i < COUNTERS; i++)
+        session_counts_[i] = 0;
+      for (uint8_t i = 0; i < LOADS; i++)
+        session_loads_[i] = 0;
+      heap_open_ = 0;
+      if (next_connected_)
+      {
+        current_[CONNECT] = next_connect_;
+        reached_[CONNECT] = true;
+      }
+    }
+
+    void SessionStats::mark(Phase phase, uint32_t now)
+    {
+      // a phase of the next session, not of the one loop() is finishing
+      if (!open_ || starting_ || (reached_[phase] && (phase != LAST_INDICATION)))
+        return;
+      current_[phase] = now - opened_;
+      reached_[phase] = true;
+    }
+
+    void SessionStats::cpu(uint32_t us)
+    {
+      if (!open_)
+        return;
+      if (us > session_loads_[EVENT_CPU])
+        session_loads_[EVENT_CPU] = us;
+      session_loads_[SESSION_CPU] += us;
+    }
+
+    void SessionStats::heap(uint32_t free, uint32_t minimum)
+    {
+      if (!open_)
+        return;
+      if (heap_open_ == 0)
+      {
+        heap_open_ = free;
+        heap_low_ = free;
+        minimum_open_ = minimum;
+      }
+      if (free < heap_low_)
+        heap_low_ = free;
+      // a new low water mark was reached during the session, between two samples
+      if ((minimum < minimum_open_) && (minimum < heap_low_))
+        heap_low_ = minimum;
+      session_loads_[HEAP] = heap_open_ - heap_low_;
+    }
+
+    bool SessionStats::finish(uint32_t now)
+    {
+      if (!open_)
+        return false;
+      open_ = false;
+      finished_ = now;
+      publishing_ = true;
+      // the next wake up starts with a fresh advertisement
+      advertised_ = 0;
+      for (uint8_t i = 0; i < PHASES; i++)
+      {
+        last_[i] = reached_[i] ? current_[i] : 0;
+        if (reached_[i])
+          summaries_[i].add(current_[i]);
+      }
+      for (uint8_t i = 0; i < COUNTERS; i++)
+      {
+        last_counts_[i] = session_counts_[i];
+        totals_[i] += session_counts_[i];
+      }
+      // PUBLISH follows once the states are sent
+      for (uint8_t i = 0; i < PUBLISH; i++)
+      {
+        last_loads_[i] = session_loads_[i];
+        load_summaries_[i].add(session_loads_[i]);
+      }
+      return true;
+    }
+
+    bool SessionStats::published(uint32_t now)
+    {
+      if (!publishing_)
+        return false;
+      publishing_ = false;
+      last_loads_[PUBLISH] = now - finished_;
+      load_summaries_[PUBLISH].add(last_loads_[PUBLISH]);
+      return true;
+    }
+
+    const char *SessionStats::name(Phase phase)
+    {
+      switch (phase)
+      {
+      case CONNECT:
+        return "connect";
+      case DISCOVERY:
+        return "discovery";
+      case REGISTERED:
+        return "registered";
+      case FIRST_INDICATION:
+        return "first indication";
+      case LAST_INDICATION:
+        return "last indication";
+      case DISCONNECT:
+        return "disconnect";
+      default:
+        return "?";
+      }
+    }
+
+    const char *SessionStats::name(Counter counter)
+    {
+      switch (counter)
+      {
+      case RECORDS:
+        return "records";
+      case DUPLICATES:
+        return "duplicates";
+      case FUTURE:
+        return "future records";
+      case CCCD_FAILURES:
+        return "CCCD failures";
+      case SETUP_RETRIES:
+        return "setup retries";
+      case SETUP_FAILURES:
+        return "setup failures";
+      default:
+        return "?";
+      }
+    }
+
+    const char *SessionStats::name(Load load)
+    {
+      switch (load)
+      {
+      case EVENT_CPU:
+        return "event cpu";
+      case SESSION_CPU:
+        return "session cpu";
+      case HEAP:
+        return "session heap";
+      case PUBLISH:
+        return "publish latency";
+      default:
+        return "?";
+      }
+    }
+  } // namespace medisana_bs444
+} // namespace esphome
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "SessionScheduler.h"
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    // Where the time of a session goes, and min/avg/max of that since boot.
+    // Phases are in ms since the connection was opened, except CONNECT which
+    // is the time from the first advertisement of a wake up to the open.
+    //
+    // Times are in milliseconds, as returned by millis(). The load of a
+    // session on the node is kept next to it, to see how many scales a node
+    // can serve.
+    class SessionStats
+    {
+    public:
+      enum Phase : uint8_t
+      {
+        CONNECT,
+        DISCOVERY,
+        REGISTERED,
+        FIRST_INDICATION,
+        LAST_INDICATION,
+        DISCONNECT,
+        PHASES,
+      };
+
+      enum Counter : uint8_t
+      {
+        RECORDS,
+        DUPLICATES,
+        FUTURE,
+        CCCD_FAILURES,
+        SETUP_RETRIES,
+        SETUP_FAILURES,
+        COUNTERS,
+      };
+
+      enum Load : uint8_t
+      {
+        EVENT_CPU,   // us, longest BLE event or loop() batch
+        SESSION_CPU, // us, all BLE events and loop() batches of the session
+        HEAP,        // bytes, free heap at the open minus the lowest free heap of the session
+        PUBLISH,     // ms, from the end of the session until its last state was sent
+        LOADS,
+      };
+
+      struct Summary
+      {
+        uint32_t min = 0;
+        uint32_t max = 0;
+        uint64_t sum = 0;
+        uint32_t count = 0;
+
+        void add(uint32_t value);
+        uint32_t avg() const { return count ? sum / count : 0; }
+      };
+
+      void advertised(uint32_t now);
+      // from the BLE callback; while loop() has not finished the previous
+      // session the new one waits for start(), its phases until then are lost
+      void opened(uint32_t now);
+      // loop() reached the start of the session in its queue
+      void start();
+      // the first mark of a phase counts, LAST_INDICATION keeps the latest
+      void mark(Phase phase, uint32_t now);
+      void count(Counter counter) { session_counts_[counter]++; }
+      // time spent handling the session, ignored when no session is open
+      void cpu(uint32_t us);
+      // free heap now and its low water mark since boot, the first sample of
+      // a session is its baseline
+      void heap(uint32_t free, uint32_t minimum);
+      // folds the session into the summaries, false if no session was open
+      bool finish(uint32_t now);
+      // the states of the finished session are sent, false if there was none
+      bool published(uint32_t now);
+
+      // of the last finished session, 0 if the phase was not reached
+      uint32_t last(Phase phase) const { return last_[phase]; }
+      uint32_t last(Counter counter) const { return last_counts_[counter]; }
+      uint32_t last(Load load) const { return last_loads_[load]; }
+      // since boot
+      uint32_t total(Counter counter) const { return totals_[counter]; }
+      const Summary &summary(Phase phase) const { return summaries_[phase]; }
+      const Summary &summary(Load load) const { return load_summaries_[load]; }
+
+      static const char *name(Phase phase);
+      static const char *name(Counter counter);
+      static const char *name(Load load);
+
+    private:
+      void start_();
+
+      bool open_ = false;
+      uint32_t opened_ = 0;
+      bool starting_ = false; // opened, start_() not called yet
+      uint32_t next_opened_ = 0;
+      uint32_t next_connect_ = 0;
+      bool next_connected_ = false;
+      uint32_t advertised_ = 0; // first advertisement of the wake up
+      uint32_t last_advertisement_ = 0;
+      uint32_t current_[PHASES] = {};
+      bool reached_[PHASES] = {};
+      uint32_t session_counts_[COUNTERS] = {};
+      uint32_t session_loads_[LOADS] = {};
+      uint32_t heap_open_ = 0;
+      uint32_t heap_low_ = 0;
+      uint32_t minimum_open_ = 0;
+      uint32_t finished_ = 0;
+      bool publishing_ = false;
+
+      uint32_t last_[PHASES] = {};
+      uint32_t last_counts_[COUNTERS] = {};
+      uint32_t totals_[COUNTERS] = {};
+      Summary summaries_[PHASES];
+      uint32_t last_loads_[LOADS] = {};
+      Summary load_summaries_[LOADS];
+    };
+  } // namespace medisana_bs444
+} // namespace esphome
@@ -0,0 +1,61 @@
+#include <cmath>
+
+#include "Trends.h"
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    // moves average towards value as if it decayed with time constant tau over dt
+    static float smooth(float average, float value, uint32_t dt, uint32_t tau)
+    {
+      return average + (value - average) * (1.0f - expf(-float(dt) / float(tau)));
+    }
+
+    bool Trends::add(const Measurement &measurement)
+    {
+      bool applied = false;
+      if (measurement.has_weight() && measurement.timestamp > weight_time)
+      {
+        const float weight = measurement.weight_kg();
+        if (weight_time == 0)
+        {
+          weight_7d = weight;
+          weight_30d = weight;
+        }
+        else
+        {
+          const uint32_t dt = measurement.timestamp - weight_time;
+          weight_7d = smooth(weight_7d, weight, dt, 7 * DAY);
+          weight_30d = smooth(weight_30d, weight, dt, 30 * DAY);
+        }
+        weight_time = measurement.timestamp;
+
+        if ((week_time[1] == 0) || (weight_time - week_time[1] >= WEEK))
+        {
+          week_time[0] = week_time[1];
+          week_weight[0] = week_weight[1];
+          week_time[1] = weight_time;
+          week_weight[1] = weight_7d;
+        }
+        applied = true;
+      }
+      if (measurement.has_body() && measurement.timestamp > fat_time)
+      {
+        const float fat = measurement.fat_percent();
+        fat_7d = (fat_time == 0) ? fat : smooth(fat_7d, fat, measurement.timestamp - fat_time, 7 * DAY);
+        fat_time = measurement.timestamp;
+        applied = true;
+      }
+      return applied;
+    }
+
+    float Trends::weekly_delta() const
+    {
+      // the previous anchor is at least a week older than the last weight
+      if (week_time[0] == 0)
+        return NAN;
+      return (weight_7d - week_weight[0]) * WEEK / float(weight_time - week_time[0]);
+    }
+  } // namespace medisana_bs444
+} // namespace esphome
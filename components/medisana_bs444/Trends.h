@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+
+#include "History.h"
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    // Running trends of one person, updated in O(1) for every new measurement.
+    // The averages are exponential moving averages over the time between the
+    // measurements, so irregular weigh-ins are weighted correctly. Plain data,
+    // it is kept in flash as is.
+    class Trends
+    {
+    public:
+      static constexpr uint32_t DAY = 24 * 60 * 60;
+      static constexpr uint32_t WEEK = 7 * DAY;
+
+      // false if nothing was applied, the record is not newer than the trends
+      bool add(const Measurement &measurement);
+
+      bool has_weight() const { return weight_time != 0; }
+      bool has_fat() const { return fat_time != 0; }
+      // change of the 7 day average in kg per week, NAN before there are two weeks of data
+      float weekly_delta() const;
+
+    public:
+      // timestamp of the last record applied
+      uint32_t weight_time = 0;
+      uint32_t fat_time = 0;
+      // kg
+      float weight_7d = 0;
+      float weight_30d = 0;
+      // %
+      float fat_7d = 0;
+      // the 7 day average at the start of the previous and the current week
+      uint32_t week_time[2] = {0, 0};
+      float week_weight[2] = {0, 0};
+    };
+  } // namespace medisana_bs444
+} // namespace esphome
@@ -0,0 +1,47 @@
+#include "UsageHistogram.h"
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    void UsageHistogram::record(uint8_t hour)
+    {
+      if (hour >= HOURS)
+        return;
+      if (buckets_[hour] == UINT8_MAX)
+      {
+        // halve everything, old habits fade out
+        sessions_ = 0;
+        for (auto &bucket : buckets_)
+        {
+          bucket /= 2;
+          sessions_ += bucket;
+        }
+      }
+      buckets_[hour]++;
+      sessions_++;
+    }
+
+    bool UsageHistogram::likely(uint8_t hour) const
+    {
+      if (sessions_ < LEARNING)
+        return true;
+      if (hour >= HOURS)
+        return true;
+      // an hour early or late is still the same habit, one-offs are not
+      const uint32_t count = buckets_[(hour + HOURS - 1) % HOURS] + buckets_[hour] + buckets_[(hour + 1) % HOURS];
+      return count * 100 >= uint32_t(sessions_) * MIN_SHARE;
+    }
+
+    uint8_t UsageHistogram::likely_hours() const
+    {
+      uint8_t hours = 0;
+      for (uint8_t hour = 0; hour < HOURS; hour++)
+      {
+        if (likely(hour))
+          hours++;
+      }
+      return hours;
+    }
+  } // namespace medisana_bs444
+} // namespace esphome
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    // When a scale gets used: session starts counted per hour of the week.
+    // Plain data, it is kept in flash as is.
+    class UsageHistogram
+    {
+    public:
+      static constexpr size_t HOURS = 7 * 24;
+      // below this many sessions every hour counts as likely
+      static constexpr uint16_t LEARNING = 14;
+      // % of the sessions around an hour that make it likely
+      static constexpr uint32_t MIN_SHARE = 2;
+
+      // hour: 0 is Sunday 00:00-00:59 local time
+      void record(uint8_t hour);
+      // sessions started around this hour before
+      bool likely(uint8_t hour) const;
+      uint16_t sessions() const { return sessions_; }
+      // hours of the week that are likely
+      uint8_t likely_hours() const;
+
+      static uint8_t hour_of_week(int day_of_week, int hour) { return ((day_of_week + 6) % 7) * 24 + hour; }
+
+    private:
+      uint8_t buckets_[HOURS] = {};
+      uint16_t sessions_ = 0;
+    };
+  } // namespace medisana_bs444
+} // namespace esphome
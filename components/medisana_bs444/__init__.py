@@ -1,15 +1,47 @@
+import re
+
 import esphome.codegen as cg
 import esphome.config_validation as cv
+import esphome.final_validate as fv
+from esphome import automation
 from esphome.components import (
     ble_client,
+    esp32_ble_tracker,
     time,
+    web_server_base,
 )
 from esphome.const import (
     CONF_ID,
     CONF_TIME_ID,
+    CONF_TRIGGER_ID,
 )
+from esphome.core import CORE
 
 CONF_TIME_OFFSET = "timeoffset"
+CONF_MODEL = "model"
+CONF_ON_MEASUREMENT = "on_measurement"
+CONF_IDLE_TIMEOUT = "idle_timeout"
+CONF_SESSION_TIMEOUT = "session_timeout"
+CONF_STREAMING = "streaming"
+CONF_MAX_SESSIONS = "max_sessions"
+CONF_MERGE = "merge"
+CONF_STORE_AND_FORWARD = "store_and_forward"
+CONF_PERSIST = "persist"
+CONF_CAPTURE = "capture"
+CONF_WEIGHT_DEADBAND = "weight_deadband"
+CONF_SCAN_WINDOW_FLOOR = "scan_window_floor"
+CONF_BODY_DEADBAND = "body_deadband"
+CONF_LOG = "log"
+CONF_CONNECTION = "connection"
+CONF_MIN_INTERVAL = "min_interval"
+CONF_MAX_INTERVAL = "max_interval"
+CONF_SUPERVISION_TIMEOUT = "supervision_timeout"
+CONF_MTU = "mtu"
+CONF_PARTITION = "partition"
+CONF_WEB_SERVER_BASE_ID = "web_server_base_id"
+CONF_MAX_CONNECTIONS = "max_connections"
+CONF_SCAN_PARAMETERS = "scan_parameters"
+CONF_WINDOW = "window"
 
 AUTO_LOAD = [
     "sensor", "binary_sensor"
@@ -17,35 +49,259 @@ AUTO_LOAD = [
 
 CODEOWNERS = ["@bwynants"]
 
-DEPENDENCIES = ["esp32", "ble_client", "time"]
+DEPENDENCIES = ["esp32", "ble_client", "esp32_ble_tracker", "time"]
 
 MULTI_CONF = True
 
+DOMAIN = "medisana_bs444"
 CONF_MedisanaBS444_ID = "medisana_bs444_id"
 
+# persons the scale can store
+MAX_PERSONS = 8
+# connections ESPHome's BLE stack allows when esp32_ble_tracker does not say
+DEFAULT_MAX_CONNECTIONS = 3
+
 
 medisana_bs444_ns = cg.esphome_ns.namespace("medisana_bs444")
 MedisanaBS444 = medisana_bs444_ns.class_(
-    "MedisanaBS444", ble_client.BLEClientNode, cg.Component
+    "MedisanaBS444",
+    ble_client.BLEClientNode,
+    esp32_ble_tracker.ESPBTDeviceListener,
+    cg.Component,
+)
+ScaleModel = medisana_bs444_ns.enum("ScaleModel", is_class=True)
+MODELS = {
+    "BS410": ScaleModel.BS410,
+    "BS430": ScaleModel.BS430,
+    "BS440": ScaleModel.BS440,
+    "BS444": ScaleModel.BS444,
+}
+# the models that count their time from 2010, what timeoffset used to select
+TIME_OFFSET = {
+    "BS410": True,
+    "BS430": False,
+    "BS440": False,
+    "BS444": True,
+}
+Measurement = medisana_bs444_ns.class_("Measurement")
+MeasurementTrigger = medisana_bs444_ns.class_(
+    "MeasurementTrigger", automation.Trigger.template(cg.uint8, Measurement)
+)
+
+def validate_model(config):
+    # timeoffset is what selected the model before there was one
+    if CONF_MODEL in config and CONF_TIME_OFFSET in config:
+        if config[CONF_TIME_OFFSET] != TIME_OFFSET[config[CONF_MODEL]]:
+            raise cv.Invalid(
+                f"{CONF_MODEL} {config[CONF_MODEL]} has {CONF_TIME_OFFSET}: "
+                f"{str(TIME_OFFSET[config[CONF_MODEL]]).lower()}, leave {CONF_TIME_OFFSET} out"
+            )
+    return config
+
+
+def validate_connection(config):
+    if config[CONF_MIN_INTERVAL] > config[CONF_MAX_INTERVAL]:
+        raise cv.Invalid(f"{CONF_MIN_INTERVAL} can not be longer than {CONF_MAX_INTERVAL}")
+    # the link has to survive a few missed connection events
+    if config[CONF_SUPERVISION_TIMEOUT].total_milliseconds <= 2 * config[CONF_MAX_INTERVAL].total_milliseconds:
+        raise cv.Invalid(f"{CONF_SUPERVISION_TIMEOUT} has to be more than twice {CONF_MAX_INTERVAL}")
+    return config
+
+
+CONNECTION_INTERVAL = cv.All(
+    cv.positive_time_period_microseconds,
+    cv.Range(min=cv.TimePeriod(microseconds=7500), max=cv.TimePeriod(milliseconds=4000)),
 )
 
-CONFIG_SCHEMA = (
+CONNECTION_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.Optional(CONF_MIN_INTERVAL, default="7.5ms"): CONNECTION_INTERVAL,
+            cv.Optional(CONF_MAX_INTERVAL, default="15ms"): CONNECTION_INTERVAL,
+            cv.Optional(CONF_SUPERVISION_TIMEOUT, default="2s"): cv.All(
+                cv.positive_time_period_milliseconds,
+                cv.Range(min=cv.TimePeriod(milliseconds=100), max=cv.TimePeriod(milliseconds=32000)),
+            ),
+        }
+    ),
+    validate_connection,
+)
+
+
+SCAN_TIME = cv.All(
+    cv.positive_time_period_milliseconds,
+    cv.Range(min=cv.TimePeriod(microseconds=2500), max=cv.TimePeriod(milliseconds=10240)),
+)
+
+CONFIG_SCHEMA = cv.All(
     ble_client.BLE_CLIENT_SCHEMA.extend(
         {
             cv.GenerateID(): cv.declare_id(MedisanaBS444),
             cv.GenerateID(CONF_TIME_ID): cv.use_id(time.RealTimeClock),
-            cv.Optional(CONF_TIME_OFFSET, default=True): cv.boolean,
+            cv.Optional(CONF_MODEL): cv.enum(MODELS, upper=True),
+            cv.Optional(CONF_TIME_OFFSET): cv.boolean,
+            cv.Optional(CONF_STREAMING, default=False): cv.boolean,
+            cv.Optional(CONF_MAX_SESSIONS): cv.int_range(min=1, max=9),
+            cv.Optional(CONF_MERGE, default=False): cv.boolean,
+            cv.Optional(CONF_STORE_AND_FORWARD): cv.All(
+                cv.requires_component("api"),
+                cv.Schema(
+                    {
+                        cv.Optional(CONF_PERSIST, default=False): cv.boolean,
+                    }
+                ),
+            ),
+            cv.Optional(CONF_CAPTURE, default=False): cv.boolean,
+            cv.Optional(CONF_WEIGHT_DEADBAND, default=0): cv.positive_float,
+            cv.Optional(CONF_BODY_DEADBAND, default=0): cv.positive_float,
+            cv.Optional(CONF_SCAN_WINDOW_FLOOR): SCAN_TIME,
+            cv.Optional(CONF_CONNECTION): CONNECTION_SCHEMA,
+            cv.Optional(CONF_MTU): cv.int_range(min=23, max=517),
+            cv.Optional(CONF_LOG): cv.Schema(
+                {
+                    cv.GenerateID(CONF_WEB_SERVER_BASE_ID): cv.use_id(web_server_base.WebServerBase),
+                    # data partition of its own, see the README for the partition table
+                    cv.Required(CONF_PARTITION): cv.All(cv.string_strict, cv.Length(max=16)),
+                }
+            ),
+            cv.Optional(
+                CONF_IDLE_TIMEOUT, default="2s"
+            ): cv.positive_time_period_milliseconds,
+            cv.Optional(
+                CONF_SESSION_TIMEOUT, default="30s"
+            ): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_ON_MEASUREMENT): automation.validate_automation(
+                {
+                    cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(MeasurementTrigger),
+                }
+            ),
         }
     )
-    .extend(cv.COMPONENT_SCHEMA)
+    .extend(esp32_ble_tracker.ESP_BLE_DEVICE_SCHEMA)
+    .extend(cv.COMPONENT_SCHEMA),
+    validate_model,
 )
 
+def tracker_config(full_config):
+    tracker = full_config.get("esp32_ble_tracker") or {}
+    if isinstance(tracker, list):
+        tracker = tracker[0] if tracker else {}
+    return tracker
+
+
+def max_connections(full_config):
+    return tracker_config(full_config).get(CONF_MAX_CONNECTIONS, DEFAULT_MAX_CONNECTIONS)
+
+
+def scan_window(full_config):
+    # the scan duty is the tracker's, the component only lowers the window
+    window = tracker_config(full_config).get(CONF_SCAN_PARAMETERS, {}).get(CONF_WINDOW)
+    return window if window is not None else cv.positive_time_period_milliseconds("30ms")
+
+
+def max_sessions(full_config):
+    # one value for the node, any scale may set it
+    values = {conf[CONF_MAX_SESSIONS] for conf in full_config.get(DOMAIN, []) if CONF_MAX_SESSIONS in conf}
+    return values.pop() if values else max_connections(full_config)
+
+
+# sensors and binary sensors of a person end in _1 .. _8
+PERSON_ENTITY = re.compile(r"_([1-%d])$" % MAX_PERSONS)
+
+
+def persons_with_entities(full_config, scale_id):
+    persons = set()
+    for domain in ("sensor", "binary_sensor"):
+        for conf in full_config.get(domain, []):
+            if conf.get("platform") != DOMAIN or str(conf.get(CONF_MedisanaBS444_ID)) != str(scale_id):
+                continue
+            persons.update(int(m.group(1)) for m in map(PERSON_ENTITY.search, conf) if m)
+    return persons
+
+
+def validate_merge(config, full_config):
+    # merged scales publish to the entities of one scale per person, the
+    # entities of the same person on the other scales would never update
+    persons = persons_with_entities(full_config, config[CONF_ID])
+    for conf in full_config.get(DOMAIN, []):
+        if not conf[CONF_MERGE] or str(conf[CONF_ID]) == str(config[CONF_ID]):
+            continue
+        shared = persons & persons_with_entities(full_config, conf[CONF_ID])
+        if shared:
+            raise cv.Invalid(
+                f"Merged scales {config[CONF_ID]} and {conf[CONF_ID]} both have entities of person "
+                f"{min(shared)}, merged scales share them: configure the entities of a person on one scale only"
+            )
+
+
+def final_validate(config):
+    full_config = fv.full_config.get()
+    if config[CONF_MERGE]:
+        validate_merge(config, full_config)
+    values = {conf[CONF_MAX_SESSIONS] for conf in full_config.get(DOMAIN, []) if CONF_MAX_SESSIONS in conf}
+    if len(values) > 1:
+        raise cv.Invalid(f"{CONF_MAX_SESSIONS} is shared by all scales of the node, set it once")
+    if values and values.pop() > max_connections(full_config):
+        raise cv.Invalid(
+            f"{CONF_MAX_SESSIONS} can not be more than the {CONF_MAX_CONNECTIONS} of esp32_ble_tracker"
+        )
+    if CONF_SCAN_WINDOW_FLOOR in config and config[CONF_SCAN_WINDOW_FLOOR] > scan_window(full_config):
+        raise cv.Invalid(f"{CONF_SCAN_WINDOW_FLOOR} can not be longer than the {CONF_SCAN_PARAMETERS} window")
+    return config
+
+
+FINAL_VALIDATE_SCHEMA = final_validate
+
+
 async def to_code(config):
-    var = cg.new_Pvariable(config[CONF_ID])
+    # older configurations without a model: the time offset selects BS444 or BS440
+    model = config.get(CONF_MODEL, "BS444" if config.get(CONF_TIME_OFFSET, True) else "BS440")
+    # only the configured models are instantiated
+    cg.add_define(f"USE_MEDISANA_BS444_MODEL_{model}")
+    var = cg.new_Pvariable(config[CONF_ID], cg.TemplateArguments(MODELS[model]))
     await cg.register_component(var, config)
     await ble_client.register_ble_node(var, config)
+    await esp32_ble_tracker.register_ble_device(var, config)
     if CONF_TIME_ID in config:
         time_ = await cg.get_variable(config[CONF_TIME_ID])
         cg.add(var.set_time_id(time_))
-    cg.add(var.use_timeoffset(config[CONF_TIME_OFFSET]))
+    cg.add(var.set_streaming(config[CONF_STREAMING]))
+    if not CORE.data.setdefault(DOMAIN, {}).get(CONF_MAX_SESSIONS):
+        # the scheduler is shared, set it from the first scale only
+        CORE.data[DOMAIN][CONF_MAX_SESSIONS] = True
+        cg.add(var.set_max_sessions(max_sessions(CORE.config)))
+    cg.add(var.set_merge(config[CONF_MERGE]))
+    if CONF_STORE_AND_FORWARD in config:
+        cg.add(var.set_store_and_forward(config[CONF_STORE_AND_FORWARD][CONF_PERSIST]))
+    cg.add(var.set_capture(config[CONF_CAPTURE]))
+    if CONF_SCAN_WINDOW_FLOOR in config:
+        # the tracker counts in 0.625 ms
+        cg.add(var.set_scan_window(
+            int(scan_window(CORE.config).total_milliseconds / 0.625),
+            int(config[CONF_SCAN_WINDOW_FLOOR].total_milliseconds / 0.625),
+        ))
+    cg.add(var.set_weight_deadband(config[CONF_WEIGHT_DEADBAND]))
+    cg.add(var.set_body_deadband(config[CONF_BODY_DEADBAND]))
+    if CONF_CONNECTION in config:
+        conf = config[CONF_CONNECTION]
+        # the controller counts intervals in 1.25 ms, the timeout in 10 ms
+        cg.add(var.set_connection_parameters(
+            int(conf[CONF_MIN_INTERVAL].total_microseconds / 1250),
+            int(conf[CONF_MAX_INTERVAL].total_microseconds / 1250),
+            int(conf[CONF_SUPERVISION_TIMEOUT].total_milliseconds / 10),
+        ))
+    if CONF_MTU in config:
+        cg.add(var.set_mtu(config[CONF_MTU]))
+    if CONF_LOG in config:
+        conf = config[CONF_LOG]
+        web_server = await cg.get_variable(conf[CONF_WEB_SERVER_BASE_ID])
+        cg.add_define("USE_MEDISANA_BS444_LOG")
+        cg.add(var.set_log(web_server, conf[CONF_PARTITION]))
+    cg.add(var.set_idle_timeout(config[CONF_IDLE_TIMEOUT]))
+    cg.add(var.set_session_timeout(config[CONF_SESSION_TIMEOUT]))
+    for conf in config.get(CONF_ON_MEASUREMENT, []):
+        trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
+        await automation.build_automation(
+            trigger, [(cg.uint8, "person"), (Measurement, "x")], conf
+        )
 
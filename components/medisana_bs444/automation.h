@@ -0,0 +1,25 @@
+#pragma once
+
+#ifdef USE_ESP32
+
+#include "esphome/core/automation.h"
+#include "medisanabs444.h"
+
+namespace esphome
+{
+  namespace medisana_bs444
+  {
+    class MeasurementTrigger : public Trigger<uint8_t, Measurement>
+    {
+    public:
+      template <ScaleModel M>
+      explicit MeasurementTrigger(MedisanaBS444<M> *parent)
+      {
+        parent->add_on_measurement_callback([this](uint8_t person, const Measurement &measurement)
+                                            { this->trigger(person, measurement); });
+      }
+    };
+  } // namespace medisana_bs444
+} // namespace esphome
+
+#endif // USE_ESP32
@@ -1,6 +1,12 @@
 #include "medisanabs444.h"
 #ifdef USE_ESP32
 
+#include <esp_gap_ble_api.h>
+#include <esp_gatt_common_api.h>
+#include <esp_heap_caps.h>
+
+#include <cstring>
+
 namespace esphome
 {
   namespace medisana_bs444
@@ -40,41 +46,907 @@ namespace esphome
 
     static const char *TAG = "MedisanaBS444";
 
-    void MedisanaBS444::dump_config()
+    template <ScaleModel M>
+    void MedisanaBS444<M>::setup()
+    {
+      this->service_uuid_ = esp32_ble::ESPBTUUID::from_raw(Model::SERVICE.data());
+#ifdef USE_TIME
+      if (this->adaptive_scan_())
+      {
+        this->usage_pref_ = global_preferences->make_preference<UsageHistogram>(
+            fnv1_hash(std::string("medisana_bs444_usage_") + this->parent()->address_str()), true);
+        if (!this->usage_pref_.load(&this->usage_))
+          this->usage_ = UsageHistogram();
+        // the tracker picks up new parameters when it restarts its scan
+        this->set_interval("adaptive_scan", 60000, [this]()
+                           { this->update_scan_duty_(); });
+      }
+#endif
+#ifdef USE_MEDISANA_BS444_LOG
+      if (this->log_partition_ && this->log_.open(this->log_partition_))
+      {
+        this->log_web_server_->init();
+        this->log_web_server_->add_handler(new LogExport(this->log_, this->log_partition_));
+      }
+#endif
+      // the local MTU applies to every connection, only touch it when asked to
+      if (this->mtu_ && (esp_ble_gatt_set_local_mtu(this->mtu_) != ESP_OK))
+        ESP_LOGW(TAG, "Could not set the local MTU to %u", this->mtu_);
+      if (this->forward_queue_ && this->forward_persist_)
+      {
+        // measurements that waited for Home Assistant survive a restart
+        this->forward_pref_ = global_preferences->make_preference<ForwardQueue>(
+            fnv1_hash(std::string("medisana_bs444_forward_") + this->parent()->address_str()), true);
+        if (!this->forward_pref_.load(this->forward_queue_.get()))
+          *this->forward_queue_ = ForwardQueue();
+      }
+      if (this->forward_queue_)
+      {
+        this->publisher_.publish(this->forward_queue_sensor_, this->forward_queue_->size());
+        this->publisher_.publish(this->forward_dropped_sensor_, this->forward_queue_->dropped());
+      }
+      this->scheduler_id_ = SessionScheduler::instance().add_scale();
+      // keyed on the scale so several scales keep their own watermarks
+      this->watermark_pref_ = global_preferences->make_preference<std::array<uint32_t, MAX_PERSONS>>(
+          fnv1_hash(std::string("medisana_bs444_") + this->parent()->address_str()), true);
+      if (!this->watermark_pref_.load(&this->sync_.watermarks()))
+        this->sync_.watermarks().fill(0);
+      this->handle_pref_ = global_preferences->make_preference<HandleTable>(
+          fnv1_hash(std::string("medisana_bs444_handles_") + this->parent()->address_str()), true);
+      if (!this->handle_pref_.load(&this->cached_handles_))
+        this->cached_handles_ = HandleTable();
+      for (auto &user : this->users_)
+      {
+        if (this->merge_ && (merged_users[user.person - 1] == nullptr))
+          merged_users[user.person - 1] = &user;
+        if (!user.has_trend_sensor())
+          continue;
+        user.trends = std::make_unique<UserEntities::TrendState>();
+        user.trends->pref = global_preferences->make_preference<Trends>(
+            fnv1_hash(std::string("medisana_bs444_trends_") + this->parent()->address_str() + "_" + to_string(user.person)), true);
+        if (!user.trends->pref.load(&user.trends->trends))
+          user.trends->trends = Trends();
+        // survives a restart of the node and of Home Assistant
+        this->publish_trends_(user);
+      }
+    }
+
+    template <ScaleModel M>
+    void MedisanaBS444<M>::dump_config()
     {
       ESP_LOGCONFIG(TAG, "MedisanaBS444:");
       if (this->parent()) {
         ESP_LOGCONFIG(TAG, "  MAC address        : %s", this->parent()->address_str());
       }
-      ESP_LOGCONFIG(TAG, "  timeoffset         : %d", this->use_timeoffset_);
-      for (uint8_t i = 0; i < 8; i++)
+      ESP_LOGCONFIG(TAG, "  model              : %s", ModelTraits<M>::NAME);
+      ESP_LOGCONFIG(TAG, "  streaming          : %d", this->streaming_);
+      ESP_LOGCONFIG(TAG, "  merge              : %d", this->merge_);
+      if (this->forward_queue_)
+        ESP_LOGCONFIG(TAG, "  store and forward  : %u queued, %" PRIu32 " dropped%s", (unsigned)this->forward_queue_->size(),
+                      this->forward_queue_->dropped(), this->forward_persist_ ? ", kept in flash" : "");
+      LOG_SENSOR(TAG, " forward queue", this->forward_queue_sensor_);
+      LOG_SENSOR(TAG, " forward dropped", this->forward_dropped_sensor_);
+#ifdef USE_TIME
+      if (this->adaptive_scan_())
+        ESP_LOGCONFIG(TAG, "  adaptive scan      : floor %" PRIu32 " ms, %u sessions, %u likely hours a week",
+                      this->scan_window_floor_ * 5 / 8, this->usage_.sessions(), this->usage_.likely_hours());
+#endif
+#ifdef USE_MEDISANA_BS444_LOG
+      if (this->log_.is_open())
+        ESP_LOGCONFIG(TAG, "  log                : %u of %u bytes, /medisana_bs444/%s.csv", (unsigned)this->log_.used(),
+                      (unsigned)this->log_.capacity(), this->log_partition_);
+#endif
+      if (this->min_interval_)
+        ESP_LOGCONFIG(TAG, "  connection         : %u..%u us, timeout %u ms, last %u us", this->min_interval_ * 1250,
+                      this->max_interval_ * 1250, this->supervision_timeout_ * 10, this->connection_interval_ * 1250);
+      if (this->mtu_)
+        ESP_LOGCONFIG(TAG, "  MTU                : %u, last %u", this->mtu_, this->negotiated_mtu_);
+      LOG_SENSOR(TAG, " connection interval", this->connection_interval_sensor_);
+      LOG_SENSOR(TAG, " MTU", this->mtu_sensor_);
+      ESP_LOGCONFIG(TAG, "  deadbands          : weight %.2f kg, body %.1f", this->weight_deadband_, this->body_deadband_);
+      if (this->cached_handles_.valid())
+        ESP_LOGCONFIG(TAG, "  cached handles     : person 0x%x, weight 0x%x, body 0x%x, command 0x%x",
+                      this->cached_handles_.person, this->cached_handles_.weight, this->cached_handles_.body,
+                      this->cached_handles_.command);
+      ESP_LOGCONFIG(TAG, "  max sessions       : %u", SessionScheduler::instance().get_max_sessions());
+      ESP_LOGCONFIG(TAG, "  missed sessions    : %" PRIu32, SessionScheduler::instance().missed(this->scheduler_id_));
+      LOG_SENSOR(TAG, " missed sessions", this->missed_sessions_sensor_);
+      ESP_LOGCONFIG(TAG, "  capture            : %d", this->capture_ != nullptr);
+      ESP_LOGCONFIG(TAG, "  dropped packets    : %" PRIu32, this->queue_.dropped());
+      ESP_LOGCONFIG(TAG, "  idle timeout       : %" PRIu32 " ms", this->idle_timeout_);
+      ESP_LOGCONFIG(TAG, "  session timeout    : %" PRIu32 " ms", this->session_timeout_);
+      for (uint8_t i = 0; i < SessionStats::PHASES; i++)
+      {
+        const auto phase = SessionStats::Phase(i);
+        const auto &summary = this->stats_.summary(phase);
+        if (summary.count)
+          ESP_LOGCONFIG(TAG, "  %-18s : min %" PRIu32 " avg %" PRIu32 " max %" PRIu32 " ms (%" PRIu32 " sessions)",
+                        SessionStats::name(phase), summary.min, summary.avg(), summary.max, summary.count);
+        LOG_SENSOR(TAG, " session phase", this->phase_sensors_[i]);
+      }
+      for (uint8_t i = 0; i < SessionStats::COUNTERS; i++)
+      {
+        const auto counter = SessionStats::Counter(i);
+        ESP_LOGCONFIG(TAG, "  %-18s : %" PRIu32, SessionStats::name(counter), this->stats_.total(counter));
+        LOG_SENSOR(TAG, " session counter", this->counter_sensors_[i]);
+      }
+      for (uint8_t i = 0; i < SessionStats::LOADS; i++)
       {
-        ESP_LOGCONFIG(TAG, "User_%d:", i);
-        if (this->weight_sensor_[i])
-          LOG_SENSOR(TAG, " weight", this->weight_sensor_[i]);
-        if (this->bmi_sensor_[i])
-          LOG_SENSOR(TAG, " BMI", this->bmi_sensor_[i]);
-        if (this->kcal_sensor_[i])
-          LOG_SENSOR(TAG, " kcal", this->kcal_sensor_[i]);
-        if (this->fat_sensor_[i])
-          LOG_SENSOR(TAG, " fat", this->fat_sensor_[i]);
-        if (this->tbw_sensor_[i])
-          LOG_SENSOR(TAG, " tbw", this->tbw_sensor_[i]);
-        if (this->muscle_sensor_[i])
-          LOG_SENSOR(TAG, " muscle", this->muscle_sensor_[i]);
-        if (this->bone_sensor_[i])
-          LOG_SENSOR(TAG, " bone", this->bone_sensor_[i]);
+        const auto load = SessionStats::Load(i);
+        const auto &summary = this->stats_.summary(load);
+        if (summary.count)
+          ESP_LOGCONFIG(TAG, "  %-18s : min %" PRIu32 " avg %" PRIu32 " max %" PRIu32 " (%" PRIu32 " sessions)",
+                        SessionStats::name(load), summary.min, summary.avg(), summary.max, summary.count);
+        LOG_SENSOR(TAG, " session load", this->load_sensors_[i]);
+      }
+      for (const auto &user : this->users_)
+      {
+        ESP_LOGCONFIG(TAG, "User_%d:", user.person);
+        LOG_SENSOR(TAG, " weight", user.sensor(UserEntities::WEIGHT));
+        LOG_SENSOR(TAG, " BMI", user.sensor(UserEntities::BMI));
+        LOG_SENSOR(TAG, " kcal", user.sensor(UserEntities::KCAL));
+        LOG_SENSOR(TAG, " fat", user.sensor(UserEntities::FAT));
+        LOG_SENSOR(TAG, " tbw", user.sensor(UserEntities::TBW));
+        LOG_SENSOR(TAG, " muscle", user.sensor(UserEntities::MUSCLE));
+        LOG_SENSOR(TAG, " bone", user.sensor(UserEntities::BONE));
+        LOG_SENSOR(TAG, " age", user.sensor(UserEntities::AGE));
+        LOG_SENSOR(TAG, " size", user.sensor(UserEntities::SIZE));
+        LOG_SENSOR(TAG, " weight 7d", user.sensor(UserEntities::WEIGHT_7D));
+        LOG_SENSOR(TAG, " weight 30d", user.sensor(UserEntities::WEIGHT_30D));
+        LOG_SENSOR(TAG, " weight weekly", user.sensor(UserEntities::WEIGHT_WEEKLY));
+        LOG_SENSOR(TAG, " fat 7d", user.sensor(UserEntities::FAT_7D));
+        LOG_SENSOR(TAG, " fat mass", user.sensor(UserEntities::FAT_MASS));
+        LOG_SENSOR(TAG, " lean mass", user.sensor(UserEntities::LEAN_MASS));
+#ifdef USE_BINARY_SENSOR
+        LOG_BINARY_SENSOR(TAG, " male", user.binary_sensor(UserEntities::MALE));
+        LOG_BINARY_SENSOR(TAG, " female", user.binary_sensor(UserEntities::FEMALE));
+        LOG_BINARY_SENSOR(TAG, " high activity", user.binary_sensor(UserEntities::HIGH_ACTIVITY));
+#endif
+      }
+      for (uint8_t i = 0; i < MAX_PERSONS; i++)
+      {
+        if (this->sync_.watermarks()[i])
+          ESP_LOGCONFIG(TAG, "  person %d synced until: %" PRIu32, i + 1, this->sync_.watermarks()[i]);
       }
     }
 
 #ifdef USE_TIME
-    void MedisanaBS444::set_time_id(time::RealTimeClock *time_id)
+    template <ScaleModel M>
+    void MedisanaBS444<M>::set_time_id(time::RealTimeClock *time_id)
     {
       this->time_id_ = time_id;
     }
+
+    template <ScaleModel M>
+    void MedisanaBS444<M>::record_usage_()
+    {
+      const auto time = this->time_id_->now();
+      if (!time.is_valid())
+        return;
+      this->usage_.record(UsageHistogram::hour_of_week(time.day_of_week, time.hour));
+      this->usage_pref_.save(&this->usage_);
+    }
+
+    template <ScaleModel M>
+    void MedisanaBS444<M>::update_scan_duty_()
+    {
+      auto &scheduler = SessionScheduler::instance();
+      const auto time = this->time_id_->now();
+      // without a valid time every hour is likely
+      scheduler.set_likely(this->scheduler_id_,
+                           !time.is_valid() || this->usage_.likely(UsageHistogram::hour_of_week(time.day_of_week, time.hour)));
+      // whichever scale sees the change first applies it, once for the node
+      if (!scheduler.scan_window_changed())
+        return;
+      ESP_LOGD(TAG, "Scanning at %s duty", scheduler.any_likely() ? "full" : "floor");
+      esp32_ble_tracker::global_esp32_ble_tracker->set_scan_window(scheduler.scan_window());
+    }
 #endif
 
-    time_t MedisanaBS444::now() const
+    template <ScaleModel M>
+    UserEntities &MedisanaBS444<M>::user_(uint8_t i)
+    {
+      for (auto &user : this->users_)
+      {
+        if (user.person == i + 1)
+          return user;
+      }
+      this->users_.push_back(UserEntities{.person = uint8_t(i + 1)});
+      return this->users_.back();
+    }
+
+    template <ScaleModel M>
+    UserEntities *MedisanaBS444<M>::find_user_(u_int32_t person)
+    {
+      // merged scales share the entities of the first scale that has them
+      if (this->merge_ && (person >= 1) && (person <= MAX_PERSONS) && merged_users[person - 1])
+        return merged_users[person - 1];
+      for (auto &user : this->users_)
+      {
+        if (user.person == person)
+          return &user;
+      }
+      return nullptr;
+    }
+
+    template <ScaleModel M>
+    void MedisanaBS444<M>::reset_session_()
+    {
+      this->sync_.start();
+      time_formatter_.reset();
+      session_published_ = false;
+      streamed_weight_ = 0;
+      streamed_body_ = 0;
+    }
+
+    template <ScaleModel M>
+    bool MedisanaBS444<M>::parse_device(const esp32_ble_tracker::ESPBTDevice &device)
+    {
+      if (!this->parent())
+        return false;
+      if (device.address_uint64() != this->parent()->get_address())
+      {
+        // point out scales that are not configured, once
+        if (!this->reported_other_scale_)
+        {
+          for (const auto &uuid : device.get_service_uuids())
+          {
+            if (uuid == this->service_uuid_)
+            {
+              ESP_LOGI(TAG, "Found a scale at %s, not the configured %s", device.address_str().c_str(),
+                       this->parent()->address_str());
+              this->reported_other_scale_ = true;
+              break;
+            }
+          }
+        }
+        return false;
+      }
+      const uint32_t now = millis();
+      SessionScheduler::instance().advertising(this->scheduler_id_, now);
+      this->stats_.advertised(now);
+      ESP_LOGV(TAG, "Scale advertising (rssi %d)", device.get_rssi());
+      // the client connects on the scale's advertisements by itself, the
+      // scheduler only enables it, so a granted slot is used right away
+      this->schedule_();
+      return true;
+    }
+
+    template <ScaleModel M>
+    void MedisanaBS444<M>::schedule_()
+    {
+      auto &scheduler = SessionScheduler::instance();
+      scheduler.update(millis());
+      const bool allowed = scheduler.may_connect(this->scheduler_id_);
+      if (allowed != this->connect_allowed_ && this->parent())
+      {
+        ESP_LOGD(TAG, "%s connections to %s", allowed ? "Allowing" : "Holding", this->parent()->address_str());
+        this->parent()->set_enabled(allowed);
+        this->connect_allowed_ = allowed;
+      }
+      if (scheduler.missed(this->scheduler_id_) != this->missed_sessions_)
+      {
+        this->missed_sessions_ = scheduler.missed(this->scheduler_id_);
+        ESP_LOGW(TAG, "Missed a session, %" PRIu32 " since boot", this->missed_sessions_);
+        if (this->missed_sessions_sensor_)
+          this->publisher_.publish(this->missed_sessions_sensor_, this->missed_sessions_);
+      }
+    }
+
+    // replay and session_sim read and write the log without ESP-IDF
+    static_assert((SessionCapture::OPEN == uint8_t(ESP_GATTC_OPEN_EVT)) &&
+                      (SessionCapture::SEARCH_CMPL == uint8_t(ESP_GATTC_SEARCH_CMPL_EVT)) &&
+                      (SessionCapture::REG_FOR_NOTIFY == uint8_t(ESP_GATTC_REG_FOR_NOTIFY_EVT)) &&
+                      (SessionCapture::WRITE_DESCR == uint8_t(ESP_GATTC_WRITE_DESCR_EVT)) &&
+                      (SessionCapture::NOTIFY == uint8_t(ESP_GATTC_NOTIFY_EVT)) &&
+                      (SessionCapture::DISCONNECT == uint8_t(ESP_GATTC_DISCONNECT_EVT)),
+                  "the capture stores esp_gattc_cb_event_t");
+
+    template <ScaleModel M>
+    void MedisanaBS444<M>::capture_event_(esp_gattc_cb_event_t event, const esp_ble_gattc_cb_param_t *param)
+    {
+      uint8_t status = 0;
+      uint16_t handle = 0;
+      const uint8_t *data = nullptr;
+      size_t len = 0;
+      switch (event)
+      {
+      case ESP_GATTC_OPEN_EVT:
+        this->capture_->clear();
+        status = param->open.status;
+        break;
+      case ESP_GATTC_DISCONNECT_EVT:
+        status = param->disconnect.reason;
+        break;
+      case ESP_GATTC_SEARCH_CMPL_EVT:
+        status = param->search_cmpl.status;
+        break;
+      case ESP_GATTC_REG_FOR_NOTIFY_EVT:
+        status = param->reg_for_notify.status;
+        handle = param->reg_for_notify.handle;
+        break;
+      case ESP_GATTC_CFG_MTU_EVT:
+        status = param->cfg_mtu.status;
+        break;
+      case ESP_GATTC_WRITE_DESCR_EVT:
+      case ESP_GATTC_WRITE_CHAR_EVT:
+        status = param->write.status;
+        handle = param->write.handle;
+        break;
+      case ESP_GATTC_READ_CHAR_EVT:
+        status = param->read.status;
+        handle = param->read.handle;
+        data = param->read.value;
+        len = param->read.value_len;
+        break;
+      case ESP_GATTC_NOTIFY_EVT:
+        handle = param->notify.handle;
+        data = param->notify.value;
+        len = param->notify.value_len;
+        break;
+      default:
+        break;
+      }
+      this->capture_->record(event, status, handle, data, len, millis());
+    }
+
+    template <ScaleModel M>
+    void MedisanaBS444<M>::dump_capture_()
+    {
+      // base64 in lines of 128 characters, concatenate them to get the log back
+      static constexpr size_t CHUNK = 96;
+      const size_t size = this->capture_->size();
+      ESP_LOGI(TAG, "capture of %u bytes%s", (unsigned)size, this->capture_->truncated() ? " (truncated)" : "");
+      for (size_t offset = 0; offset < size; offset += CHUNK)
+      {
+        const size_t len = (size - offset) < CHUNK ? (size - offset) : CHUNK;
+        ESP_LOGI(TAG, "capture %u: %s", (unsigned)(offset / CHUNK), base64_encode(this->capture_->data() + offset, len).c_str());
+      }
+      this->capture_->clear();
+    }
+
+    template <ScaleModel M>
+    void MedisanaBS444<M>::loop()
+    {
+      this->schedule_();
+      // resends setup requests that were not confirmed in time
+      this->run_setup_();
+      if (this->forward_queue_)
+        this->flush_forward_();
+      this->publisher_.loop();
+      if ((this->publisher_.pending() == 0) && this->stats_.published(millis()))
+        this->publish_load_(SessionStats::PUBLISH);
+
+      // everything the BLE callback queued, in order, a history dump is
+      // usually a single batch
+      bool data = false;
+      for (auto batch = this->queue_.batch(); !batch.empty(); batch = this->queue_.batch())
+      {
+        uint32_t start = micros();
+        for (const auto &packet : batch)
+        {
+          switch (packet.kind)
+          {
+          case Packet::SESSION_START:
+            this->stats_.start();
+            this->reset_session_();
+            data = false;
+            break;
+          case Packet::PERSON:
+          {
+            const auto &person = this->sync_.person(packet.payload());
+#if ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_DEBUG
+            char buffer[FORMAT_BUFFER_SIZE];
+            ESP_LOGD(TAG, "data person %s:", person.format(buffer, sizeof(buffer)));
+#endif
+            data = true;
+            break;
+          }
+          case Packet::WEIGHT:
+          {
+            this->stats_.count(SessionStats::RECORDS);
+            Weight weight;
+            if (this->handled_(this->sync_.add(packet.payload(), this->now(), weight), "weight"))
+              this->stream_weight_(weight);
+            data = true;
+            break;
+          }
+          case Packet::BODY:
+          {
+            this->stats_.count(SessionStats::RECORDS);
+            Body body;
+            if (this->handled_(this->sync_.add(packet.payload(), this->now(), body), "body"))
+              this->stream_body_(body);
+            data = true;
+            break;
+          }
+          case Packet::SESSION_END:
+            this->publish_session_();
+            this->stats_.cpu(micros() - start);
+            start = micros();
+            this->finish_stats_();
+            data = false;
+            break;
+          }
+        }
+        this->queue_.pop(batch.size());
+        this->stats_.heap(heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+                          heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL));
+        this->stats_.cpu(micros() - start);
+      }
+      // once per batch instead of per packet, it re-arms a timer
+      if (data)
+        this->check_dump_complete_();
+    }
+
+    template <ScaleModel M>
+    bool MedisanaBS444<M>::discover_handles_(HandleTable &handles)
+    {
+      const auto service = esp32_ble::ESPBTUUID::from_raw(Model::SERVICE.data());
+      auto find = [this, &service](const Uuid128 &uuid, uint16_t &handle)
+      {
+        const auto characteristic = esp32_ble::ESPBTUUID::from_raw(uuid.data());
+        auto *chr = this->parent()->get_characteristic(service, characteristic);
+        if (chr == nullptr)
+        {
+          ESP_LOGE(TAG, "No characteristic found at service %s char %s", service.to_string().c_str(),
+                   characteristic.to_string().c_str());
+          return false;
+        }
+        handle = chr->handle;
+        return true;
+      };
+      return find(Model::CHAR_PERSON, handles.person) && find(Model::CHAR_WEIGHT, handles.weight) &&
+             find(Model::CHAR_BODY, handles.body) && find(Model::CHAR_COMMAND, handles.command);
+    }
+
+    template <ScaleModel M>
+    void MedisanaBS444<M>::start_setup_()
+    {
+      this->setup_.start(handles_.person, handles_.weight, handles_.body, handles_.command);
+      this->run_setup_();
+    }
+
+    template <ScaleModel M>
+    void MedisanaBS444<M>::run_setup_()
+    {
+      if (!this->setup_.active() || !this->parent())
+        return;
+      const bool enabled = this->setup_.enabled();
+      while (auto action = this->setup_.next(millis()))
+      {
+        if (action.retry)
+        {
+          ESP_LOGW(TAG, "Retrying setup of handle 0x%x", action.handle);
+          this->stats_.count(SessionStats::SETUP_RETRIES);
+        }
+        esp_err_t status = ESP_OK;
+        switch (action.kind)
+        {
+        case SessionSetup::Action::REGISTER:
+          status = esp_ble_gattc_register_for_notify(this->parent()->get_gattc_if(), this->parent()->get_remote_bda(),
+                                                     action.handle);
+          break;
+        case SessionSetup::Action::WRITE_CCCD:
+        {
+          uint8_t indicationOn[] = {0x2, 0x0};
+          status = esp_ble_gattc_write_char_descr(this->parent()->get_gattc_if(), this->parent()->get_conn_id(),
+                                                  action.handle, sizeof(indicationOn), indicationOn,
+                                                  ESP_GATT_WRITE_TYPE_RSP, ESP_GATT_AUTH_REQ_NONE);
+          break;
+        }
+        case SessionSetup::Action::WRITE_COMMAND:
+        {
+          // the scale sends its history once it has the time
+          uint8_t byteArray[5] = {2, 0, 0, 0, 0};
+          convertTimestampToLittleEndian(now() - Model::EPOCH, &byteArray[1]);
+          status = esp_ble_gattc_write_char_descr(this->parent()->get_gattc_if(), this->parent()->get_conn_id(),
+                                                  action.handle, sizeof(byteArray), byteArray,
+                                                  ESP_GATT_WRITE_TYPE_RSP, ESP_GATT_AUTH_REQ_NONE);
+          break;
+        }
+        default:
+          break;
+        }
+        // no confirmation will come, it is sent again after the step timeout
+        if (status != ESP_OK)
+        {
+          ESP_LOGW(TAG, "Setup request for handle 0x%x failed, status=%d", action.handle, status);
+          if (action.kind == SessionSetup::Action::WRITE_CCCD)
+            this->stats_.count(SessionStats::CCCD_FAILURES);
+        }
+      }
+
+      if (!enabled && this->setup_.enabled())
+      {
+        ESP_LOGD(TAG, "Indications enabled");
+        this->node_state = esp32_ble_tracker::ClientState::ESTABLISHED;
+        this->stats_.mark(SessionStats::REGISTERED, millis());
+      }
+      if (this->setup_.state() == SessionSetup::State::DONE)
+        ESP_LOGD(TAG, "History requested");
+      else if (this->setup_.state() == SessionSetup::State::FAILED)
+      {
+        this->stats_.count(SessionStats::SETUP_FAILURES);
+        this->end_session_("setup failed");
+      }
+    }
+
+    template <ScaleModel M>
+    void MedisanaBS444<M>::publish_weight_(UserEntities &user, const Measurement &weight, uint8_t size)
+    {
+#if ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_INFO
+      char buffer[FORMAT_BUFFER_SIZE];
+      ESP_LOGI(TAG, "Weight %s:", weight.format(buffer, sizeof(buffer), time_formatter_));
+#endif
+      // a new weigh-in is published even when it repeats the last values
+      const bool fresh = weight.timestamp != user.weight_timestamp;
+      user.weight_timestamp = weight.timestamp;
+      this->publisher_.publish(user.sensor(UserEntities::WEIGHT), weight.weight_kg(), this->weight_deadband_, fresh);
+      if (size)
+        this->publisher_.publish(user.sensor(UserEntities::BMI), float(bmi(weight.weight, size)) / BMI_SCALE, 0, fresh);
+    }
+
+    template <ScaleModel M>
+    void MedisanaBS444<M>::publish_body_(UserEntities &user, const Measurement &body)
+    {
+#if ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_INFO
+      char buffer[FORMAT_BUFFER_SIZE];
+      ESP_LOGI(TAG, "Body %s:", body.format(buffer, sizeof(buffer), time_formatter_));
+#endif
+      const bool fresh = body.timestamp != user.body_timestamp;
+      user.body_timestamp = body.timestamp;
+      this->publisher_.publish(user.sensor(UserEntities::KCAL), body.kcal, 0, fresh);
+      this->publisher_.publish(user.sensor(UserEntities::FAT), body.fat_percent(), this->body_deadband_, fresh);
+      this->publisher_.publish(user.sensor(UserEntities::TBW), body.tbw_percent(), this->body_deadband_, fresh);
+      this->publisher_.publish(user.sensor(UserEntities::MUSCLE), body.muscle_percent(), this->body_deadband_, fresh);
+      this->publisher_.publish(user.sensor(UserEntities::BONE), body.bone_kg(), this->body_deadband_, fresh);
+      if (body.has_weight())
+      {
+        const float fat_mass = body.weight_kg() * body.fat_percent() / 100.0f;
+        this->publisher_.publish(user.sensor(UserEntities::FAT_MASS), fat_mass, this->weight_deadband_, fresh);
+        this->publisher_.publish(user.sensor(UserEntities::LEAN_MASS), body.weight_kg() - fat_mass, this->weight_deadband_, fresh);
+      }
+    }
+
+    template <ScaleModel M>
+    void MedisanaBS444<M>::publish_trends_(const UserEntities &user)
+    {
+      const auto &trends = user.trends->trends;
+      if (trends.has_weight())
+      {
+        this->publisher_.publish(user.sensor(UserEntities::WEIGHT_7D), trends.weight_7d, this->weight_deadband_);
+        this->publisher_.publish(user.sensor(UserEntities::WEIGHT_30D), trends.weight_30d, this->weight_deadband_);
+        this->publisher_.publish(user.sensor(UserEntities::WEIGHT_WEEKLY), trends.weekly_delta(), this->weight_deadband_);
+      }
+      if (trends.has_fat())
+        this->publisher_.publish(user.sensor(UserEntities::FAT_7D), trends.fat_7d, this->body_deadband_);
+    }
+
+    template <ScaleModel M>
+    bool MedisanaBS444<M>::is_live_(u_int32_t person, time_t timestamp) const
+    {
+      // the record of the person standing on the scale right now
+      const auto &current = this->sync_.person();
+      return this->streaming_ && current.valid && (current.person == person) && (timestamp + LIVE_WINDOW >= now());
+    }
+
+    template <ScaleModel M>
+    void MedisanaBS444<M>::publish_session_()
+    {
+      // once per session, at the end of the dump or at disconnect
+      if (this->session_published_)
+        return;
+      this->session_published_ = true;
+
+      const auto &person = this->sync_.person();
+      if (person.valid)
+      {
+        // this is a measurement
+#if ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_INFO
+        char buffer[FORMAT_BUFFER_SIZE];
+        ESP_LOGI(TAG, "Person %s:", person.format(buffer, sizeof(buffer)));
+#endif
+        if ((person.person >= 1) && (person.person <= MAX_PERSONS))
+        {
+          auto *user = this->find_user_(person.person);
+          if (user)
+          {
+            // static data, only sent when it changed
+            if (person.age)
+              this->publisher_.publish(user->sensor(UserEntities::AGE), person.age);
+            if (person.size)
+              this->publisher_.publish(user->sensor(UserEntities::SIZE), person.size);
+#ifdef USE_BINARY_SENSOR
+            this->publisher_.publish(user->binary_sensor(UserEntities::MALE), person.male);
+            this->publisher_.publish(user->binary_sensor(UserEntities::FEMALE), !person.male);
+            this->publisher_.publish(user->binary_sensor(UserEntities::HIGH_ACTIVITY), person.highActivity);
+#endif
+          }
+          if (auto *history = this->sync_.history(person.person))
+          {
+            // queued measurements are published when they are handed out
+            const bool forwarding = this->forwarding_();
+            // the newest record may have been streamed already
+            auto *weight = history->newest(Measurement::HAS_WEIGHT);
+            if (user && !forwarding && weight && weight->timestamp != this->streamed_weight_ &&
+                this->is_current_(person.person, weight->timestamp) && !this->merged_(person.person, *weight))
+              this->publish_weight_(*user, *weight, person.valid ? person.size : 0);
+            auto *body = history->newest(Measurement::HAS_BODY);
+            if (user && !forwarding && body && body->timestamp != this->streamed_body_ &&
+                this->is_current_(person.person, body->timestamp) && !this->merged_(person.person, *body))
+              this->publish_body_(*user, *body);
+            // hand out the backlog, oldest first with the original timestamps
+            bool trends = false;
+            auto pending = this->sync_.hand_out([this, &person, user, forwarding, &trends](const Measurement &measurement)
+                                                {
+                                                  if (this->merge_ && !MeasurementIndex::instance().add(person.person, measurement.timestamp,
+                                                                                                        this->scheduler_id_, measurement.weight))
+                                                  {
+                                                    ESP_LOGD(TAG, "Skipped measurement of person %u handed out by another scale", person.person);
+                                                    this->stats_.count(SessionStats::DUPLICATES);
+                                                    return true;
+                                                  }
+                                                  if (user && user->trends)
+                                                    trends |= user->trends->trends.add(measurement);
+#ifdef USE_MEDISANA_BS444_LOG
+                                                  if (this->log_.is_open() && !this->log_.append(person.person, measurement))
+                                                    ESP_LOGW(TAG, "Could not log the measurement of person %u", person.person);
+#endif
+                                                  if (forwarding)
+                                                  {
+                                                    // delivered when the queue flushes it
+                                                    this->forward_(person.person, person.valid ? person.size : 0, measurement);
+                                                    return false;
+                                                  }
+                                                  this->measurement_callback_.call(person.person, measurement);
+                                                  return true; });
+            ESP_LOGD(TAG, "%u new measurements for person %u", (unsigned)pending, person.person);
+            // only write flash when there is something new
+            if (this->sync_.watermarks_changed())
+              this->watermark_pref_.save(&this->sync_.watermarks());
+            if (trends)
+            {
+              user->trends->pref.save(&user->trends->trends);
+              this->publish_trends_(*user);
+            }
+          }
+        }
+      }
+    }
+
+    template <ScaleModel M>
+    bool MedisanaBS444<M>::api_connected_() const
+    {
+#ifdef USE_API
+      return api::global_api_server && api::global_api_server->is_connected();
+#else
+      return true;
+#endif
+    }
+
+    template <ScaleModel M>
+    void MedisanaBS444<M>::forward_(uint8_t person, uint8_t size, const Measurement &measurement)
+    {
+      // a queue kept in flash outlives the watermark of a reboot, the scale
+      // sends the queued records again
+      if (this->forward_queue_->contains(person, measurement.timestamp))
+        return;
+      ESP_LOGD(TAG, "Home Assistant not connected, queued the measurement of person %u", person);
+      this->forward_queue_->push(person, size, measurement);
+      this->forward_changed_();
+    }
+
+    template <ScaleModel M>
+    void MedisanaBS444<M>::flush_forward_()
+    {
+      if (!this->api_connected_())
+      {
+        this->connected_since_ = 0;
+        return;
+      }
+      const uint32_t now = millis();
+      if (this->connected_since_ == 0)
+        this->connected_since_ = now;
+      if (this->forward_queue_->empty() || (now - this->connected_since_ < FORWARD_GRACE) ||
+          (now - this->last_forward_ < FORWARD_INTERVAL))
+        return;
+      this->last_forward_ = now;
+
+      // oldest first, the entities end up at the newest
+      const auto entry = this->forward_queue_->front();
+      this->forward_queue_->pop();
+      const auto &measurement = entry.measurement;
+      if (auto *user = this->find_user_(entry.person); user && this->is_current_(entry.person, measurement.timestamp))
+      {
+        if (measurement.has_weight())
+          this->publish_weight_(*user, measurement, entry.size);
+        if (measurement.has_body())
+          this->publish_body_(*user, measurement);
+      }
+      this->measurement_callback_.call(entry.person, measurement);
+      this->sync_.delivered(entry.person, measurement);
+      if (this->sync_.watermarks_changed())
+        this->watermark_pref_.save(&this->sync_.watermarks());
+      this->forward_changed_();
+    }
+
+    template <ScaleModel M>
+    void MedisanaBS444<M>::forward_changed_()
+    {
+      if (this->forward_persist_)
+        this->forward_pref_.save(this->forward_queue_.get());
+      this->publisher_.publish(this->forward_queue_sensor_, this->forward_queue_->size());
+      this->publisher_.publish(this->forward_dropped_sensor_, this->forward_queue_->dropped());
+    }
+
+    template <ScaleModel M>
+    void MedisanaBS444<M>::end_session_(const char *reason)
+    {
+      ESP_LOGD(TAG, "Ending session: %s", reason);
+      this->publish_session_();
+      // no need to wait for the scale to drop the link
+      if (this->parent())
+        this->parent()->disconnect();
+    }
+
+    template <ScaleModel M>
+    void MedisanaBS444<M>::finish_stats_()
+    {
+      if (!this->stats_.finish(millis()))
+        return;
+      ESP_LOGD(TAG, "Session: connect %" PRIu32 " ms, discovery %" PRIu32 " ms, registered %" PRIu32
+                    " ms, indications %" PRIu32 "..%" PRIu32 " ms, disconnect %" PRIu32 " ms",
+               this->stats_.last(SessionStats::CONNECT), this->stats_.last(SessionStats::DISCOVERY),
+               this->stats_.last(SessionStats::REGISTERED), this->stats_.last(SessionStats::FIRST_INDICATION),
+               this->stats_.last(SessionStats::LAST_INDICATION), this->stats_.last(SessionStats::DISCONNECT));
+      ESP_LOGD(TAG, "Session: %" PRIu32 " records, %" PRIu32 " duplicates, %" PRIu32 " future, %" PRIu32 " CCCD failures",
+               this->stats_.last(SessionStats::RECORDS), this->stats_.last(SessionStats::DUPLICATES),
+               this->stats_.last(SessionStats::FUTURE), this->stats_.last(SessionStats::CCCD_FAILURES));
+      for (uint8_t i = 0; i < SessionStats::PHASES; i++)
+      {
+        // a phase that was not reached has no time
+        if (this->stats_.summary(SessionStats::Phase(i)).count)
+          this->publisher_.publish(this->phase_sensors_[i], this->stats_.last(SessionStats::Phase(i)));
+      }
+      for (uint8_t i = 0; i < SessionStats::COUNTERS; i++)
+        this->publisher_.publish(this->counter_sensors_[i], this->stats_.total(SessionStats::Counter(i)));
+      ESP_LOGD(TAG, "Session: cpu %" PRIu32 " us (longest event %" PRIu32 " us), heap %" PRIu32 " bytes",
+               this->stats_.last(SessionStats::SESSION_CPU), this->stats_.last(SessionStats::EVENT_CPU),
+               this->stats_.last(SessionStats::HEAP));
+      for (uint8_t i = 0; i < SessionStats::PUBLISH; i++)
+        this->publish_load_(SessionStats::Load(i));
+    }
+
+    template <ScaleModel M>
+    void MedisanaBS444<M>::publish_load_(SessionStats::Load load)
+    {
+      this->publisher_.publish(this->load_sensors_[load], this->stats_.last(load));
+    }
+
+    template <ScaleModel M>
+    void MedisanaBS444<M>::check_dump_complete_()
+    {
+      // the scale sends its full history, weight and body for each record
+      if (this->sync_.complete())
+        this->end_session_("complete history received");
+      else
+      {
+        this->set_timeout("idle", this->idle_timeout_, [this]()
+                          { this->end_session_("no more data"); });
+        if (this->min_interval_)
+          this->set_timeout("relax", RELAX_AFTER, [this]()
+                            { this->update_connection_(RELAXED_MIN_INTERVAL, RELAXED_MAX_INTERVAL); });
+      }
+    }
+
+    template <ScaleModel M>
+    void MedisanaBS444<M>::update_connection_(uint16_t min_interval, uint16_t max_interval)
+    {
+      if (this->parent() == nullptr)
+        return;
+      esp_ble_conn_update_params_t params = {};
+      memcpy(params.bda, this->parent()->get_remote_bda(), sizeof(esp_bd_addr_t));
+      params.min_int = min_interval;
+      params.max_int = max_interval;
+      params.latency = 0;
+      params.timeout = this->supervision_timeout_;
+      const esp_err_t err = esp_ble_gap_update_conn_params(&params);
+      if (err != ESP_OK)
+        ESP_LOGW(TAG, "Connection parameter update failed, err=%d", err);
+    }
+
+    template <ScaleModel M>
+    void MedisanaBS444<M>::gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+    {
+      if ((event != ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT) || (this->parent() == nullptr) ||
+          (memcmp(param->update_conn_params.bda, this->parent()->get_remote_bda(), sizeof(esp_bd_addr_t)) != 0))
+        return;
+      if (param->update_conn_params.status != ESP_BT_STATUS_SUCCESS)
+      {
+        ESP_LOGW(TAG, "Connection parameters not accepted, status=%d", param->update_conn_params.status);
+        return;
+      }
+      this->connection_interval_ = param->update_conn_params.conn_int;
+      ESP_LOGD(TAG, "Connection interval %u us, latency %u, timeout %u ms", this->connection_interval_ * 1250,
+               param->update_conn_params.latency, param->update_conn_params.timeout * 10);
+      this->publisher_.publish(this->connection_interval_sensor_, this->connection_interval_ * 1.25f);
+    }
+
+    template <ScaleModel M>
+    bool MedisanaBS444<M>::handled_(Result result, const char *kind)
+    {
+      switch (result)
+      {
+      case Result::ADDED:
+        return true;
+      case Result::SYNCED:
+        ESP_LOGV(TAG, "Skipped synced %s", kind);
+        this->stats_.count(SessionStats::DUPLICATES);
+        break;
+      case Result::DUPLICATE:
+        ESP_LOGD(TAG, "Skipped duplicate %s!", kind);
+        this->stats_.count(SessionStats::DUPLICATES);
+        break;
+      case Result::FUTURE:
+        ESP_LOGE(TAG, "Skipped future event!");
+        this->stats_.count(SessionStats::FUTURE);
+        break;
+      case Result::MALFORMED:
+        ESP_LOGW(TAG, "Skipped malformed %s packet", kind);
+        break;
+      case Result::NO_PERSON:
+        ESP_LOGD(TAG, "Skipped %s!", kind);
+        break;
+      }
+      return false;
+    }
+
+    template <ScaleModel M>
+    void MedisanaBS444<M>::stream_weight_(const Weight &data)
+    {
+#if ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_DEBUG
+      char buffer[FORMAT_BUFFER_SIZE];
+      ESP_LOGD(TAG, "data weight %s:", data.format(buffer, sizeof(buffer), time_formatter_));
+#endif
+      if (!this->is_live_(data.person, data.timestamp))
+        return;
+      // only when nothing newer is known yet
+      auto *newest = this->sync_.history(data.person)->newest(Measurement::HAS_WEIGHT);
+      auto *user = this->find_user_(data.person);
+      // queued measurements are published when they are handed out
+      if (user && !this->forwarding_() && (newest->timestamp == data.timestamp) &&
+          this->is_current_(data.person, data.timestamp) && !this->merged_(data.person, *newest))
+      {
+        const auto &person = this->sync_.person();
+        this->publish_weight_(*user, *newest, person.valid ? person.size : 0);
+        this->streamed_weight_ = data.timestamp;
+      }
+    }
+
+    template <ScaleModel M>
+    void MedisanaBS444<M>::stream_body_(const Body &data)
+    {
+#if ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_DEBUG
+      char buffer[FORMAT_BUFFER_SIZE];
+      ESP_LOGD(TAG, "data body %s:", data.format(buffer, sizeof(buffer), time_formatter_));
+#endif
+      if (!this->is_live_(data.person, data.timestamp))
+        return;
+      // only when nothing newer is known yet
+      auto *newest = this->sync_.history(data.person)->newest(Measurement::HAS_BODY);
+      auto *user = this->find_user_(data.person);
+      // queued measurements are published when they are handed out
+      if (user && !this->forwarding_() && (newest->timestamp == data.timestamp) &&
+          this->is_current_(data.person, data.timestamp) && !this->merged_(data.person, *newest))
+      {
+        this->publish_body_(*user, *newest);
+        this->streamed_body_ = data.timestamp;
+      }
+    }
+
+    template <ScaleModel M>
+    time_t MedisanaBS444<M>::now() const
     {
 #ifdef USE_TIME
       if (this->time_id_)
@@ -83,9 +955,14 @@ namespace esphome
       return millis() / 1000; // some stupid value.....
     }
 
-    void MedisanaBS444::gattc_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if,
+    template <ScaleModel M>
+    void MedisanaBS444<M>::gattc_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if,
                                             esp_ble_gattc_cb_param_t *param)
     {
+      const uint32_t start = micros();
+      if (this->capture_)
+        this->capture_event_(event, param);
+
       switch (event)
       {
       case ESP_GATTC_OPEN_EVT:
@@ -94,6 +971,27 @@ namespace esphome
         if (param->open.status == ESP_GATT_OK)
         {
           ESP_LOGI(TAG, "Connected successfully!");
+          SessionScheduler::instance().session_started(this->scheduler_id_, millis());
+          this->stats_.opened(millis());
+#ifdef USE_TIME
+          if (this->adaptive_scan_())
+            this->record_usage_();
+#endif
+          // before anything else, discovery is faster at a short interval too
+          if (this->min_interval_)
+            this->update_connection_(this->min_interval_, this->max_interval_);
+          this->handles_ = HandleTable();
+          this->queue_.push(Packet::SESSION_START);
+          if (this->cached_handles_.valid() && this->parent())
+          {
+            // handles are fixed per scale, no need to wait for service discovery
+            ESP_LOGD(TAG, "Using cached handles");
+            this->handles_ = this->cached_handles_;
+            this->start_setup_();
+          }
+          // watchdog for sessions that stall before the dump is complete
+          this->set_timeout("session", this->session_timeout_, [this]()
+                            { this->end_session_("session timeout"); });
         }
         break;
       }
@@ -102,50 +1000,15 @@ namespace esphome
       {
         ESP_LOGD(TAG, "ESP_GATTC_DISCONNECT_EVT!");
         this->node_state = esp32_ble_tracker::ClientState::IDLE;
-        if (mPerson.valid)
-        {
-          // this is a measurement
-          ESP_LOGI(TAG, "Person %s:", mPerson.toString().c_str());
-          if ((mPerson.person >= 1) && (mPerson.person <= 8))
-          {
-            uint8_t index = mPerson.person - 1;
-            // static data
-            if (this->age_sensor_[index] && mPerson.age)
-              this->age_sensor_[index]->publish_state(mPerson.age);
-            if (this->size_sensor_[index] && mPerson.size)
-              this->size_sensor_[index]->publish_state(mPerson.size * 100);
-#ifdef USE_BINARY_SENSOR
-            if (this->male_sensor_[index])
-              this->male_sensor_[index]->publish_state(mPerson.male);
-            if (this->female_sensor_[index])
-              this->female_sensor_[index]->publish_state(!mPerson.male);
-            if (this->high_activity_sensor_[index])
-              this->high_activity_sensor_[index]->publish_state(mPerson.highActivity);
-#endif
-            if (mWeight.valid && (mWeight.person == mPerson.person))
-            {
-              ESP_LOGI(TAG, "Weight %s:", mWeight.toString(mPerson).c_str());
-              if (this->weight_sensor_[index])
-                this->weight_sensor_[index]->publish_state(mWeight.weight);
-              if (this->bmi_sensor_[index] && mPerson.size)
-                this->bmi_sensor_[index]->publish_state(mWeight.weight / (mPerson.size * mPerson.size));
-            }
-            if (mBody.valid && (mBody.person == mPerson.person))
-            {
-              ESP_LOGI(TAG, "Body %s:", mBody.toString().c_str());
-              if (this->kcal_sensor_[index])
-                this->kcal_sensor_[index]->publish_state(mBody.kcal);
-              if (this->fat_sensor_[index])
-                this->fat_sensor_[index]->publish_state(mBody.fat);
-              if (this->tbw_sensor_[index])
-                this->tbw_sensor_[index]->publish_state(mBody.tbw);
-              if (this->muscle_sensor_[index])
-                this->muscle_sensor_[index]->publish_state(mBody.muscle);
-              if (this->bone_sensor_[index])
-                this->bone_sensor_[index]->publish_state(mBody.bone);
-            }
-          }
-        }
+        SessionScheduler::instance().session_ended(this->scheduler_id_, millis());
+        this->stats_.mark(SessionStats::DISCONNECT, millis());
+        this->setup_.stop();
+        this->cancel_timeout("idle");
+        this->cancel_timeout("relax");
+        this->cancel_timeout("session");
+        this->queue_.push(Packet::SESSION_END);
+        if (this->capture_)
+          this->dump_capture_();
 
         break;
       }
@@ -153,38 +1016,27 @@ namespace esphome
       case ESP_GATTC_SEARCH_CMPL_EVT:
       {
         ESP_LOGD(TAG, "ESP_GATTC_SEARCH_CMPL_EVT!");
-        // reset
-        mPerson = Person();
-        mBody = Body();
-        mWeight = Weight();
-        registered_notifications_ = 0;
-        for (const auto &characteristic : mCharacteristics)
+        if (!this->parent()) {
+          ESP_LOGE(TAG, "Parent BLE client not available");
+          break;
+        }
+        HandleTable handles;
+        if (!this->discover_handles_(handles))
+          break;
+        ESP_LOGD(TAG, "All characteristic found for %s", ModelTraits<M>::NAME);
+        this->stats_.mark(SessionStats::DISCOVERY, millis());
+        if (handles == this->handles_)
         {
-          if (!this->parent()) {
-            ESP_LOGE(TAG, "Parent BLE client not available");
-            break;
-          }
-          auto *chr = this->parent()->get_characteristic(mServiceUUID, characteristic);
-          if (chr == nullptr)
-          {
-            ESP_LOGE(TAG, "No sensor read characteristic found at service %s char %s", mServiceUUID.to_string().c_str(),
-                     characteristic.to_string().c_str());
-            break;
-          }
-
-          auto status_notify = esp_ble_gattc_register_for_notify(this->parent()->get_gattc_if(), this->parent()->get_remote_bda(), chr->handle);
-          if (status_notify)
-          {
-            ESP_LOGE(TAG, "esp_ble_gattc_register_for_notify failed, status=%d", status_notify);
-          }
-          else
-          {
-            mCharacteristicHandles[registered_notifications_] = chr->handle;
-            registered_notifications_++;
-          }
+          // already registered at connect
+          ESP_LOGD(TAG, "Cached handles confirmed");
+          break;
         }
-
-        ESP_LOGD(TAG, "All characteristic found at service %s", mServiceUUID.to_string().c_str());
+        if (this->cached_handles_.valid())
+          ESP_LOGW(TAG, "Cached handles do not match the scale, registering again");
+        this->handles_ = handles;
+        this->cached_handles_ = handles;
+        this->handle_pref_.save(&this->cached_handles_);
+        this->start_setup_();
         break;
       }
 
@@ -201,109 +1053,89 @@ namespace esphome
         break;
       }
 
-      case ESP_GATTC_REG_FOR_NOTIFY_EVT:
+      case ESP_GATTC_CFG_MTU_EVT:
       {
-        ESP_LOGD(TAG, "ESP_GATTC_REG_FOR_NOTIFY_EVT!");
-        if (--registered_notifications_ == 0)
+        // the exchange is BLEClientBase's, with the local MTU set in setup()
+        if (!this->parent() || param->cfg_mtu.conn_id != this->parent()->get_conn_id())
+          break;
+        if (param->cfg_mtu.status != ESP_GATT_OK)
         {
-          // all notify requests are handled
-          this->node_state = esp32_ble_tracker::ClientState::ESTABLISHED;
-
-          const uint8_t indicationOn[] = {0x2, 0x0};
-          // for (uint8_t i = 0; i < 3; i++)
-          for (const auto &handle : mCharacteristicHandles)
-          {
-            // send indicate for these handles
-            if (!this->parent()) {
-              ESP_LOGE(TAG, "Parent BLE client not available");
-              break;
-            }
-            auto status = esp_ble_gattc_write_char_descr(this->parent()->get_gattc_if(), this->parent()->get_conn_id(),
-                                                         handle + 1, sizeof(indicationOn), (uint8_t *)indicationOn,
-                                                         ESP_GATT_WRITE_TYPE_RSP, ESP_GATT_AUTH_REQ_NONE);
-            if (status)
-            {
-              ESP_LOGE(TAG, "Error sending write request for characteristic handle, status=%d", status);
-            }
-            else
-            {
-              ESP_LOGD(TAG, "notification on for characteristic handle 0x%x", handle);
-            }
-          }
-
-          if (!this->parent()) {
-            ESP_LOGE(TAG, "Parent BLE client not available");
-            break;
-          }
-          auto *write_chr = this->parent()->get_characteristic(mServiceUUID, Char_command);
-          if (write_chr == nullptr)
-          {
-            ESP_LOGE(TAG, "No write characteristic found at service %s char %s", mServiceUUID.to_string().c_str(),
-                     Char_command.to_string().c_str());
-            break;
-          }
-
-          uint8_t byteArray[5] = {2, 0, 0, 0, 0};
-          convertTimestampToLittleEndian(now() - (use_timeoffset_ ? time_offset : 0), &byteArray[1]);
-
-          auto status = esp_ble_gattc_write_char_descr(this->parent()->get_gattc_if(), this->parent()->get_conn_id(),
-                                                       write_chr->handle, sizeof(byteArray), (uint8_t *)byteArray,
-                                                       ESP_GATT_WRITE_TYPE_RSP, ESP_GATT_AUTH_REQ_NONE);
-          if (status)
-          {
-            ESP_LOGE(TAG, "Error sending datetimestamp, status=%d", status);
-          }
-          ESP_LOGD(TAG, "request to send data sent");
+          ESP_LOGW(TAG, "MTU exchange failed, status=%d", param->cfg_mtu.status);
+          break;
         }
+        this->negotiated_mtu_ = param->cfg_mtu.mtu;
+        ESP_LOGD(TAG, "MTU %u", this->negotiated_mtu_);
+        this->publisher_.publish(this->mtu_sensor_, this->negotiated_mtu_);
+        break;
+      }
+
+      case ESP_GATTC_REG_FOR_NOTIFY_EVT:
+      {
+        ESP_LOGD(TAG, "ESP_GATTC_REG_FOR_NOTIFY_EVT!");
+        this->setup_.registered(param->reg_for_notify.handle, param->reg_for_notify.status == ESP_GATT_OK);
+        this->run_setup_();
         break;
       }
 
       case ESP_GATTC_NOTIFY_EVT:
       {
-        ESP_LOGD(TAG, "ESP_GATTC_NOTIFY_EVT! 0x%x, %d", param->notify.handle, param->notify.value_len);
-        if (mCharacteristicHandles[0] == param->notify.handle)
-        {
-          mPerson = Person::decode(param->notify.value);
-          ESP_LOGI(TAG, "data person %s:", mPerson.toString().c_str());
-        }
-        else if (mCharacteristicHandles[1] == param->notify.handle)
+        ESP_LOGV(TAG, "ESP_GATTC_NOTIFY_EVT! 0x%x, %d", param->notify.handle, param->notify.value_len);
+        // only copy the data here, it is decoded in loop()
+        Packet::Kind kind;
+        if (handles_.person == param->notify.handle)
+          kind = Packet::PERSON;
+        else if (handles_.weight == param->notify.handle)
+          kind = Packet::WEIGHT;
+        else if (handles_.body == param->notify.handle)
+          kind = Packet::BODY;
+        else
         {
-          auto data = Weight::decode(param->notify.value, use_timeoffset_);
-          if (data.timestamp <= now())
-          {
-            ESP_LOGI(TAG, "data weight %s:", data.toString().c_str());
-            if (!mWeight.valid || (mWeight < data))
-              mWeight = data;
-            else
-              ESP_LOGI(TAG, "Skipped weight!");
-          }
-          else
-            ESP_LOGE(TAG, "Skipped future event!");
+          ESP_LOGE(TAG, "Skipped future event!");
+          break;
         }
-        else if (mCharacteristicHandles[2] == param->notify.handle)
+        this->queue_.push(kind, param->notify.value, param->notify.value_len);
+        this->stats_.mark(SessionStats::FIRST_INDICATION, millis());
+        this->stats_.mark(SessionStats::LAST_INDICATION, millis());
+        break;
+      }
+
+      case ESP_GATTC_WRITE_DESCR_EVT:
+      {
+        if (param->write.status != ESP_GATT_OK)
         {
-          auto data = Body::decode(param->notify.value, use_timeoffset_);
-          if (data.timestamp <= now())
-          {
-            ESP_LOGI(TAG, "data body %s:", data.toString().c_str());
-            if (!mBody.valid || (mBody < data))
-              mBody = data;
-            else
-              ESP_LOGI(TAG, "Skipped body!");
-          }
-          else
-            ESP_LOGE(TAG, "Skipped future event!");
+          ESP_LOGW(TAG, "Write to descriptor 0x%x failed, status=%d", param->write.handle, param->write.status);
+          if (param->write.handle != this->handles_.command)
+            this->stats_.count(SessionStats::CCCD_FAILURES);
         }
-        else
-          ESP_LOGE(TAG, "Skipped future event!");
+        this->setup_.written(param->write.handle, param->write.status == ESP_GATT_OK);
+        this->run_setup_();
         break;
       }
 
       default:
         break;
       }
+      // the session is open from OPEN_EVT on, so that event counts as well
+      this->stats_.heap(heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+                        heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL));
+      this->stats_.cpu(micros() - start);
     }
 
+    // only the instances of the configured models end up in the firmware,
+    // __init__.py defines USE_MEDISANA_BS444_MODEL_ for each of them
+#ifdef USE_MEDISANA_BS444_MODEL_BS410
+    template class MedisanaBS444<ScaleModel::BS410>;
+#endif
+#ifdef USE_MEDISANA_BS444_MODEL_BS430
+    template class MedisanaBS444<ScaleModel::BS430>;
+#endif
+#ifdef USE_MEDISANA_BS444_MODEL_BS440
+    template class MedisanaBS444<ScaleModel::BS440>;
+#endif
+#ifdef USE_MEDISANA_BS444_MODEL_BS444
+    template class MedisanaBS444<ScaleModel::BS444>;
+#endif
+
   } // namespace medisana_bs444
 } // namespace esphome
 
@@ -3,6 +3,8 @@
 #ifdef USE_ESP32
 
 #include "esphome/core/component.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/preferences.h"
 
 #include "esphome/components/sensor/sensor.h"
 #ifdef USE_BINARY_SENSOR
@@ -11,12 +13,34 @@
 #include "esphome/components/ble_client/ble_client.h"
 #include "esphome/components/esp32_ble_tracker/esp32_ble_tracker.h"
 
+#ifdef USE_API
+#include "esphome/components/api/api_server.h"
+#endif
 #ifdef USE_TIME
 #include "esphome/components/time/real_time_clock.h"
 #include "esphome/core/time.h"
 #endif
 
+#include <array>
+#include <memory>
+#include <vector>
+
 #include "Scale.h"
+#include "ForwardQueue.h"
+#include "History.h"
+#include "HistorySync.h"
+#include "LogExport.h"
+#include "MeasurementIndex.h"
+#include "MeasurementLog.h"
+#include "PacketRing.h"
+#include "Protocol.h"
+#include "Publisher.h"
+#include "SessionCapture.h"
+#include "SessionScheduler.h"
+#include "SessionSetup.h"
+#include "SessionStats.h"
+#include "Trends.h"
+#include "UsageHistogram.h"
 
 /******************************* BS444 Scale *******************************************/
 /**
@@ -54,76 +78,385 @@ namespace esphome
 {
   namespace medisana_bs444
   {
-    class MedisanaBS444 : public Component, public esphome::ble_client::BLEClientNode
+    // GATT handles of the scale, fixed for a given scale
+    struct HandleTable
+    {
+      uint16_t person = 0;
+      uint16_t weight = 0;
+      uint16_t body = 0;
+      uint16_t command = 0;
+
+      bool valid() const { return person && weight && body && command; }
+      bool operator==(const HandleTable &) const = default;
+    };
+
+    // the entities configured for one person of the scale, a person with a
+    // few sensors does not carry a slot for every metric
+    struct UserEntities
+    {
+      enum Metric : uint8_t
+      {
+        WEIGHT,
+        BMI,
+        KCAL,
+        FAT,
+        TBW,
+        MUSCLE,
+        BONE,
+        AGE,
+        SIZE,
+        // trends over the measurements
+        WEIGHT_7D,
+        WEIGHT_30D,
+        WEIGHT_WEEKLY,
+        FAT_7D,
+        FAT_MASS,
+        LEAN_MASS,
+      };
+
+      uint8_t person; // 1..8
+      std::vector<std::pair<Metric, sensor::Sensor *>> sensors{};
+      // nullptr if the metric is not configured
+      sensor::Sensor *sensor(Metric metric) const
+      {
+        for (const auto &entry : sensors)
+        {
+          if (entry.first == metric)
+            return entry.second;
+        }
+        return nullptr;
+      }
+      bool has_trend_sensor() const
+      {
+        return sensor(WEIGHT_7D) || sensor(WEIGHT_30D) || sensor(WEIGHT_WEEKLY) || sensor(FAT_7D);
+      }
+      // scale time of the last weight and body published, a new one is always sent
+      uint32_t weight_timestamp = 0;
+      uint32_t body_timestamp = 0;
+      // running state of the trends, kept in flash, only when a trend sensor is configured
+      struct TrendState
+      {
+        Trends trends{};
+        ESPPreferenceObject pref{};
+      };
+      std::unique_ptr<TrendState> trends{};
+#ifdef USE_BINARY_SENSOR
+      enum Flag : uint8_t
+      {
+        MALE,
+        FEMALE,
+        HIGH_ACTIVITY,
+      };
+      std::vector<std::pair<Flag, binary_sensor::BinarySensor *>> binary_sensors{};
+      binary_sensor::BinarySensor *binary_sensor(Flag flag) const
+      {
+        for (const auto &entry : binary_sensors)
+        {
+          if (entry.first == flag)
+            return entry.second;
+        }
+        return nullptr;
+      }
+#endif
+    };
+
+    // entities of the first merged scale that configured the person, shared by all merged scales
+    inline std::array<UserEntities *, MAX_PERSONS> merged_users{};
+
+    // one instance per configured model, the decoders are bound at compile time
+    template <ScaleModel M>
+    class MedisanaBS444 : public Component, public esphome::ble_client::BLEClientNode, public esp32_ble_tracker::ESPBTDeviceListener
     {
 
     private:
-      // The service(es) we are interested in
-      const esp32_ble::ESPBTUUID mServiceUUID = Serv_SCALE;
-      // The characteristic of the remote service we are interested in.
-      const esp32_ble::ESPBTUUID mCharacteristics[3] = {Char_person, Char_weight, Char_body};
-      uint16_t mCharacteristicHandles[3] = {0, 0, 0};
-      // last read values
-      Person mPerson;
-      Weight mWeight;
-      Body mBody;
+      // decoders and UUIDs of the configured model
+      using Model = typename ModelTraits<M>::Protocol;
+      // handles of this session, and the ones found on the last discovery (kept in flash)
+      HandleTable handles_;
+      HandleTable cached_handles_;
+      ESPPreferenceObject handle_pref_;
+      // registration, indications and the command of the current session
+      SessionSetup setup_;
+      // raw indications, filled by the BLE callback and drained in loop()
+      PacketRing<64> queue_;
+      // person, histories and watermarks of the dump
+      HistorySync<Model> sync_;
+      using Result = typename HistorySync<Model>::Result;
+      // local time cache for the log lines of one session
+      TimeFormatter time_formatter_;
 
     public:
       MedisanaBS444() = default;
 
+      void setup() override;
+      void loop() override;
       void dump_config() override;
 
+      bool parse_device(const esp32_ble_tracker::ESPBTDevice &device) override;
+
+      void add_on_measurement_callback(std::function<void(uint8_t, const Measurement &)> &&callback)
+      {
+        this->measurement_callback_.add(std::move(callback));
+      }
+
     protected:
       time_t now() const;
 
+      void schedule_();
+      void reset_session_();
+      bool discover_handles_(HandleTable &handles);
+      void start_setup_();
+      void run_setup_();
+      // logs and counts what happened to a weight or body packet, true if added
+      bool handled_(Result result, const char *kind);
+      void stream_weight_(const Weight &data);
+      void stream_body_(const Body &data);
+      void check_dump_complete_();
+      void publish_session_();
+      // size in cm for the BMI, 0 if not known
+      void publish_weight_(UserEntities &user, const Measurement &weight, uint8_t size);
+      void publish_body_(UserEntities &user, const Measurement &body);
+      void publish_trends_(const UserEntities &user);
+      bool is_live_(u_int32_t person, time_t timestamp) const;
+      void end_session_(const char *reason);
+
+      // the watermarks of sync_, kept in flash
+      ESPPreferenceObject watermark_pref_;
+
+      CallbackManager<void(uint8_t, const Measurement &)> measurement_callback_;
+
       void gattc_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param);
+      void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) override;
 
     public:
-      void set_weight(uint8_t i, sensor::Sensor *sensor) { weight_sensor_[i] = sensor; }
-      void set_bmi(uint8_t i, sensor::Sensor *sensor) { bmi_sensor_[i] = sensor; }
-      void set_kcal(uint8_t i, sensor::Sensor *sensor) { kcal_sensor_[i] = sensor; }
-      void set_fat(uint8_t i, sensor::Sensor *sensor) { fat_sensor_[i] = sensor; }
-      void set_tbw(uint8_t i, sensor::Sensor *sensor) { tbw_sensor_[i] = sensor; }
-      void set_muscle(uint8_t i, sensor::Sensor *sensor) { muscle_sensor_[i] = sensor; }
-      void set_bone(uint8_t i, sensor::Sensor *sensor) { bone_sensor_[i] = sensor; }
-      void set_age(uint8_t i, sensor::Sensor *sensor) { age_sensor_[i] = sensor; }
-      void set_size(uint8_t i, sensor::Sensor *sensor) { size_sensor_[i] = sensor; }
+      void set_weight(uint8_t i, sensor::Sensor *sensor) { user_(i).sensors.emplace_back(UserEntities::WEIGHT, sensor); }
+      void set_bmi(uint8_t i, sensor::Sensor *sensor) { user_(i).sensors.emplace_back(UserEntities::BMI, sensor); }
+      void set_kcal(uint8_t i, sensor::Sensor *sensor) { user_(i).sensors.emplace_back(UserEntities::KCAL, sensor); }
+      void set_fat(uint8_t i, sensor::Sensor *sensor) { user_(i).sensors.emplace_back(UserEntities::FAT, sensor); }
+      void set_tbw(uint8_t i, sensor::Sensor *sensor) { user_(i).sensors.emplace_back(UserEntities::TBW, sensor); }
+      void set_muscle(uint8_t i, sensor::Sensor *sensor) { user_(i).sensors.emplace_back(UserEntities::MUSCLE, sensor); }
+      void set_bone(uint8_t i, sensor::Sensor *sensor) { user_(i).sensors.emplace_back(UserEntities::BONE, sensor); }
+      void set_age(uint8_t i, sensor::Sensor *sensor) { user_(i).sensors.emplace_back(UserEntities::AGE, sensor); }
+      void set_size(uint8_t i, sensor::Sensor *sensor) { user_(i).sensors.emplace_back(UserEntities::SIZE, sensor); }
+      void set_weight_7d(uint8_t i, sensor::Sensor *sensor) { user_(i).sensors.emplace_back(UserEntities::WEIGHT_7D, sensor); }
+      void set_weight_30d(uint8_t i, sensor::Sensor *sensor) { user_(i).sensors.emplace_back(UserEntities::WEIGHT_30D, sensor); }
+      void set_weight_weekly(uint8_t i, sensor::Sensor *sensor) { user_(i).sensors.emplace_back(UserEntities::WEIGHT_WEEKLY, sensor); }
+      void set_fat_7d(uint8_t i, sensor::Sensor *sensor) { user_(i).sensors.emplace_back(UserEntities::FAT_7D, sensor); }
+      void set_fat_mass(uint8_t i, sensor::Sensor *sensor) { user_(i).sensors.emplace_back(UserEntities::FAT_MASS, sensor); }
+      void set_lean_mass(uint8_t i, sensor::Sensor *sensor) { user_(i).sensors.emplace_back(UserEntities::LEAN_MASS, sensor); }
 #ifdef USE_BINARY_SENSOR
-      void set_male(uint8_t i, binary_sensor::BinarySensor *sensor) { male_sensor_[i] = sensor; }
-      void set_female(uint8_t i, binary_sensor::BinarySensor *sensor) { female_sensor_[i] = sensor; }
-      void set_high_activity(uint8_t i, binary_sensor::BinarySensor *sensor) { high_activity_sensor_[i] = sensor; }
+      void set_male(uint8_t i, binary_sensor::BinarySensor *sensor) { user_(i).binary_sensors.emplace_back(UserEntities::MALE, sensor); }
+      void set_female(uint8_t i, binary_sensor::BinarySensor *sensor) { user_(i).binary_sensors.emplace_back(UserEntities::FEMALE, sensor); }
+      void set_high_activity(uint8_t i, binary_sensor::BinarySensor *sensor)
+      {
+        user_(i).binary_sensors.emplace_back(UserEntities::HIGH_ACTIVITY, sensor);
+      }
 #endif
     protected:
-      sensor::Sensor *weight_sensor_[8]{nullptr};
-      sensor::Sensor *bmi_sensor_[8]{nullptr};
-      sensor::Sensor *kcal_sensor_[8]{nullptr};
-      sensor::Sensor *fat_sensor_[8]{nullptr};
-      sensor::Sensor *tbw_sensor_[8]{nullptr};
-      sensor::Sensor *muscle_sensor_[8]{nullptr};
-      sensor::Sensor *bone_sensor_[8]{nullptr};
-      sensor::Sensor *age_sensor_[8]{nullptr};
-      sensor::Sensor *size_sensor_[8]{nullptr};
-#ifdef USE_BINARY_SENSOR
-      binary_sensor::BinarySensor *male_sensor_[8]{nullptr};
-      binary_sensor::BinarySensor *female_sensor_[8]{nullptr};
-      binary_sensor::BinarySensor *high_activity_sensor_[8]{nullptr};
-#endif
+      // entry for person i + 1, created while the configuration is applied
+      UserEntities &user_(uint8_t i);
+      // entities of a person, nullptr if none are configured
+      UserEntities *find_user_(u_int32_t person);
+
+      // only the persons that have entities configured
+      std::vector<UserEntities> users_;
+
     public:
-      void use_timeoffset(bool use_timeoffset) { use_timeoffset_ = use_timeoffset; }
+      void set_capture(bool capture) { capture_.reset(capture ? new SessionCapture() : nullptr); }
 
     protected:
-      bool use_timeoffset_ = false;
+      void capture_event_(esp_gattc_cb_event_t event, const esp_ble_gattc_cb_param_t *param);
+      void dump_capture_();
+
+      // GATTC events of the current session, only when capturing
+      std::unique_ptr<SessionCapture> capture_;
+
+    public:
+      // shared by all scales on the node
+      void set_max_sessions(uint8_t max_sessions) { SessionScheduler::instance().set_max_sessions(max_sessions); }
+      void set_missed_sessions(sensor::Sensor *sensor) { missed_sessions_sensor_ = sensor; }
+
+    public:
+      void set_phase_sensor(SessionStats::Phase phase, sensor::Sensor *sensor) { phase_sensors_[phase] = sensor; }
+      void set_counter_sensor(SessionStats::Counter counter, sensor::Sensor *sensor) { counter_sensors_[counter] = sensor; }
+      void set_load_sensor(SessionStats::Load load, sensor::Sensor *sensor) { load_sensors_[load] = sensor; }
+
+    protected:
+      void finish_stats_();
+      void publish_load_(SessionStats::Load load);
+
+      SessionStats stats_;
+      // last session per phase, totals since boot per counter
+      std::array<sensor::Sensor *, SessionStats::PHASES> phase_sensors_{};
+      std::array<sensor::Sensor *, SessionStats::COUNTERS> counter_sensors_{};
+      // last session per load
+      std::array<sensor::Sensor *, SessionStats::LOADS> load_sensors_{};
+
+    protected:
+      uint8_t scheduler_id_ = 0;
+      bool connect_allowed_ = true;
+      sensor::Sensor *missed_sessions_sensor_{nullptr};
+      uint32_t missed_sessions_ = 0;
 
 #ifdef USE_TIME
     public:
       void set_time_id(time::RealTimeClock *time_id);
+      // the window of the tracker's scan_parameters and the one outside the
+      // hours the scale is usually used, in units of 0.625 ms; the scan duty
+      // is one for the whole node, the scheduler keeps it
+      void set_scan_window(uint32_t window, uint32_t floor)
+      {
+        SessionScheduler::instance().set_scan_windows(window, floor);
+        scan_window_floor_ = floor;
+      }
 
     protected:
       time::RealTimeClock *time_id_ = nullptr;
+
+      bool adaptive_scan_() const { return this->scan_window_floor_ && this->time_id_; }
+      void record_usage_();
+      void update_scan_duty_();
+
+      // session starts per hour of the week, kept in flash
+      UsageHistogram usage_;
+      ESPPreferenceObject usage_pref_;
+      uint32_t scan_window_floor_ = 0;
 #endif
 
+    protected:
+      esp32_ble::ESPBTUUID service_uuid_;
+      bool reported_other_scale_ = false;
+
+    public:
+      // in units of 1.25 ms and 10 ms, as the controller takes them
+      void set_connection_parameters(uint16_t min_interval, uint16_t max_interval, uint16_t timeout)
+      {
+        min_interval_ = min_interval;
+        max_interval_ = max_interval;
+        supervision_timeout_ = timeout;
+      }
+      void set_mtu(uint16_t mtu) { mtu_ = mtu; }
+      void set_connection_interval_sensor(sensor::Sensor *sensor) { connection_interval_sensor_ = sensor; }
+      void set_mtu_sensor(sensor::Sensor *sensor) { mtu_sensor_ = sensor; }
+
+    protected:
+      void update_connection_(uint16_t min_interval, uint16_t max_interval);
+
+      // every indication of the dump waits for a connection event, ask for
+      // short intervals while it runs, 0: leave the connection alone
+      uint16_t min_interval_ = 0;
+      uint16_t max_interval_ = 0;
+      uint16_t supervision_timeout_ = 0;
+      uint16_t mtu_ = 0;
+      // what the controller settled on for the current or last session
+      uint16_t connection_interval_ = 0;
+      uint16_t negotiated_mtu_ = 0;
+      sensor::Sensor *connection_interval_sensor_ = nullptr;
+      sensor::Sensor *mtu_sensor_ = nullptr;
+      // the intervals ESP-IDF connects with, for the rest of the session
+      static constexpr uint16_t RELAXED_MIN_INTERVAL = 24; // 30 ms
+      static constexpr uint16_t RELAXED_MAX_INTERVAL = 40; // 50 ms
+      // no indication for this long: the dump is over
+      static constexpr uint32_t RELAX_AFTER = 250;
+
+    public:
+      void set_weight_deadband(float deadband) { weight_deadband_ = deadband; }
+      void set_body_deadband(float deadband) { body_deadband_ = deadband; }
+
+    protected:
+      // all entity states go through here, spread over loop() iterations
+      Publisher publisher_;
+      // changes this small are not published, kg and % / kg of the body values
+      float weight_deadband_ = 0;
+      float body_deadband_ = 0;
+
+#ifdef USE_MEDISANA_BS444_LOG
+    public:
+      void set_log(web_server_base::WebServerBase *web_server, const char *partition)
+      {
+        log_web_server_ = web_server;
+        log_partition_ = partition;
+      }
+
+    protected:
+      // every measurement handed out, in a data partition of its own
+      MeasurementLog log_;
+      web_server_base::WebServerBase *log_web_server_ = nullptr;
+      const char *log_partition_ = nullptr;
+#endif
+
+    public:
+      void set_store_and_forward(bool persist)
+      {
+        forward_queue_.reset(new ForwardQueue());
+        forward_persist_ = persist;
+      }
+      void set_forward_queue_sensor(sensor::Sensor *sensor) { forward_queue_sensor_ = sensor; }
+      void set_forward_dropped_sensor(sensor::Sensor *sensor) { forward_dropped_sensor_ = sensor; }
+
+    protected:
+      bool api_connected_() const;
+      // whether measurements go through the queue instead of straight out
+      bool forwarding_() const { return this->forward_queue_ && (!this->forward_queue_->empty() || !this->api_connected_()); }
+      void forward_(uint8_t person, uint8_t size, const Measurement &measurement);
+      void flush_forward_();
+      void forward_changed_();
+
+      // measurements kept while Home Assistant is not connected, when enabled
+      std::unique_ptr<ForwardQueue> forward_queue_;
+      bool forward_persist_ = false;
+      ESPPreferenceObject forward_pref_;
+      sensor::Sensor *forward_queue_sensor_ = nullptr;
+      sensor::Sensor *forward_dropped_sensor_ = nullptr;
+      uint32_t connected_since_ = 0;
+      uint32_t last_forward_ = 0;
+      // give Home Assistant time to subscribe, then hand out one at a time
+      static constexpr uint32_t FORWARD_GRACE = 5000;
+      static constexpr uint32_t FORWARD_INTERVAL = 500;
+
+    public:
+      void set_merge(bool merge) { merge_ = merge; }
+
+    protected:
+      // nothing newer of the person was handed out by any merged scale
+      bool is_current_(uint8_t person, uint32_t timestamp) const
+      {
+        return !this->merge_ || MeasurementIndex::instance().is_current(person, timestamp);
+      }
+      // another merged scale handed out the measurement already
+      bool merged_(uint8_t person, const Measurement &measurement) const
+      {
+        return this->merge_ &&
+               MeasurementIndex::instance().contains(person, measurement.timestamp, this->scheduler_id_, measurement.weight);
+      }
+
+      // one stream and one set of entities per person for all merged scales
+      bool merge_ = false;
+
+    public:
+      void set_streaming(bool streaming) { streaming_ = streaming; }
+
+    protected:
+      // publish the live measurement as soon as it is received
+      bool streaming_ = false;
+      // records this recent are the live measurement
+      static constexpr time_t LIVE_WINDOW = 5 * 60;
+
+    public:
+      void set_idle_timeout(uint32_t idle_timeout) { idle_timeout_ = idle_timeout; }
+      void set_session_timeout(uint32_t session_timeout) { session_timeout_ = session_timeout; }
+
+    protected:
+      // end the session this long after the last indication
+      uint32_t idle_timeout_ = 2000;
+      // abort sessions that take longer than this
+      uint32_t session_timeout_ = 30000;
+
     private:
-      u_int32_t registered_notifications_ = 0;
+      bool session_published_ = true;
+      // timestamps of the records published while streaming
+      uint32_t streamed_weight_ = 0;
+      uint32_t streamed_body_ = 0;
     };
   } // namespace medisana_bs444
 } // namespace esphome
@@ -3,11 +3,16 @@ import esphome.config_validation as cv
 from esphome.components import sensor
 
 from esphome.const import (
+    ENTITY_CATEGORY_DIAGNOSTIC,
     STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
     UNIT_KILOGRAM,
     UNIT_EMPTY,
     UNIT_PERCENT,
     UNIT_CENTIMETER,
+    UNIT_MILLISECOND,
+    UNIT_MICROSECOND,
+    UNIT_BYTES,
     CONF_WEIGHT,
     CONF_SIZE,
     ICON_SCALE_BATHROOM,
@@ -15,6 +20,9 @@ from esphome.const import (
     ICON_EMPTY,
     ICON_RULER,
     ICON_TIMELAPSE,
+    ICON_TIMER,
+    ICON_COUNTER,
+    ICON_MEMORY,
     DEVICE_CLASS_WEIGHT,
 )
 UNIT_KILOCALORIES="kcal"
@@ -26,17 +34,85 @@ CONF_TBW="tbw"
 CONF_MUSCLE="muscle"
 CONF_BONE="bone"
 CONF_AGE="age"
+CONF_MISSED_SESSIONS="missed_sessions"
+CONF_CONNECTION_INTERVAL="connection_interval"
+CONF_MTU="mtu"
+CONF_FORWARD_QUEUE="forward_queue"
+CONF_FORWARD_DROPPED="forward_dropped"
+CONF_WEIGHT_7D="weight_7d"
+CONF_WEIGHT_30D="weight_30d"
+CONF_WEIGHT_WEEKLY="weight_weekly"
+CONF_FAT_7D="fat_7d"
+CONF_FAT_MASS="fat_mass"
+CONF_LEAN_MASS="lean_mass"
 
 UNIT_AGE="y"
+UNIT_KILOGRAM_PER_WEEK="kg/week"
 
-from .. import MedisanaBS444, medisana_bs444_ns, CONF_MedisanaBS444_ID
+from .. import MedisanaBS444, medisana_bs444_ns, CONF_MedisanaBS444_ID, MAX_PERSONS
+
+SessionStats = medisana_bs444_ns.class_("SessionStats")
+Phase = SessionStats.enum("Phase")
+Counter = SessionStats.enum("Counter")
+Load = SessionStats.enum("Load")
+
+# session timing, ms since the connection was opened (connect: since the first advertisement)
+PHASES = {
+    "connect_time": Phase.CONNECT,
+    "discovery_time": Phase.DISCOVERY,
+    "register_time": Phase.REGISTERED,
+    "first_indication_time": Phase.FIRST_INDICATION,
+    "last_indication_time": Phase.LAST_INDICATION,
+    "session_time": Phase.DISCONNECT,
+}
+# totals since boot
+COUNTERS = {
+    "records": Counter.RECORDS,
+    "duplicates": Counter.DUPLICATES,
+    "future_records": Counter.FUTURE,
+    "cccd_failures": Counter.CCCD_FAILURES,
+    "setup_retries": Counter.SETUP_RETRIES,
+    "setup_failures": Counter.SETUP_FAILURES,
+}
+# cost of the last session on the node
+LOADS = {
+    "event_cpu_time": (Load.EVENT_CPU, UNIT_MICROSECOND, ICON_TIMER),
+    "session_cpu_time": (Load.SESSION_CPU, UNIT_MICROSECOND, ICON_TIMER),
+    "session_heap": (Load.HEAP, UNIT_BYTES, ICON_MEMORY),
+    "publish_latency": (Load.PUBLISH, UNIT_MILLISECOND, ICON_TIMER),
+}
+
+DIAGNOSTICS = cv.Schema({
+    cv.Optional(conf): sensor.sensor_schema(
+        unit_of_measurement=UNIT_MILLISECOND,
+        icon=ICON_TIMER,
+        accuracy_decimals=0,
+        state_class=STATE_CLASS_MEASUREMENT,
+        entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+    ) for conf in PHASES
+}).extend({
+    cv.Optional(conf): sensor.sensor_schema(
+        icon=ICON_COUNTER,
+        accuracy_decimals=0,
+        state_class=STATE_CLASS_TOTAL_INCREASING,
+        entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+    ) for conf in COUNTERS
+}).extend({
+    cv.Optional(conf): sensor.sensor_schema(
+        unit_of_measurement=unit,
+        icon=icon,
+        accuracy_decimals=0,
+        state_class=STATE_CLASS_MEASUREMENT,
+        entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+    ) for conf, (_, unit, icon) in LOADS.items()
+})
 
 MEASUREMENTS = cv.Schema({
     });
 
 
 # Generate schema for 8 persons
-for x in range(1, 8):
+for x in range(1, MAX_PERSONS + 1):
     MEASUREMENTS = MEASUREMENTS.extend(
         cv.Schema(
         {
@@ -94,6 +170,47 @@ for x in range(1, 8):
                 icon=ICON_RULER,
                 accuracy_decimals=0,
             ),
+            # trends, computed on the node
+            cv.Optional("%s_%s" %(CONF_WEIGHT_7D,x)): sensor.sensor_schema(
+                unit_of_measurement=UNIT_KILOGRAM,
+                icon=ICON_SCALE_BATHROOM,
+                accuracy_decimals=2,
+                device_class=DEVICE_CLASS_WEIGHT,
+                state_class=STATE_CLASS_MEASUREMENT,
+            ),
+            cv.Optional("%s_%s" %(CONF_WEIGHT_30D,x)): sensor.sensor_schema(
+                unit_of_measurement=UNIT_KILOGRAM,
+                icon=ICON_SCALE_BATHROOM,
+                accuracy_decimals=2,
+                device_class=DEVICE_CLASS_WEIGHT,
+                state_class=STATE_CLASS_MEASUREMENT,
+            ),
+            cv.Optional("%s_%s" %(CONF_WEIGHT_WEEKLY,x)): sensor.sensor_schema(
+                unit_of_measurement=UNIT_KILOGRAM_PER_WEEK,
+                icon=ICON_SCALE_BATHROOM,
+                accuracy_decimals=2,
+                state_class=STATE_CLASS_MEASUREMENT,
+            ),
+            cv.Optional("%s_%s" %(CONF_FAT_7D,x)): sensor.sensor_schema(
+                unit_of_measurement=UNIT_PERCENT,
+                icon=ICON_PERCENT,
+                accuracy_decimals=1,
+                state_class=STATE_CLASS_MEASUREMENT,
+            ),
+            cv.Optional("%s_%s" %(CONF_FAT_MASS,x)): sensor.sensor_schema(
+                unit_of_measurement=UNIT_KILOGRAM,
+                icon=ICON_SCALE_BATHROOM,
+                accuracy_decimals=1,
+                device_class=DEVICE_CLASS_WEIGHT,
+                state_class=STATE_CLASS_MEASUREMENT,
+            ),
+            cv.Optional("%s_%s" %(CONF_LEAN_MASS,x)): sensor.sensor_schema(
+                unit_of_measurement=UNIT_KILOGRAM,
+                icon=ICON_SCALE_BATHROOM,
+                accuracy_decimals=1,
+                device_class=DEVICE_CLASS_WEIGHT,
+                state_class=STATE_CLASS_MEASUREMENT,
+            ),
         }
         )
     )
@@ -101,16 +218,75 @@ for x in range(1, 8):
 CONFIG_SCHEMA = cv.All(
         cv.Schema({
             cv.GenerateID(CONF_MedisanaBS444_ID): cv.use_id(MedisanaBS444),
+            cv.Optional(CONF_MISSED_SESSIONS): sensor.sensor_schema(
+                icon=ICON_SCALE_BATHROOM,
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_TOTAL_INCREASING,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
+            cv.Optional(CONF_CONNECTION_INTERVAL): sensor.sensor_schema(
+                unit_of_measurement=UNIT_MILLISECOND,
+                icon=ICON_TIMER,
+                accuracy_decimals=2,
+                state_class=STATE_CLASS_MEASUREMENT,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
+            cv.Optional(CONF_MTU): sensor.sensor_schema(
+                icon=ICON_MEMORY,
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_MEASUREMENT,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
+            cv.Optional(CONF_FORWARD_QUEUE): sensor.sensor_schema(
+                icon=ICON_COUNTER,
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_MEASUREMENT,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
+            cv.Optional(CONF_FORWARD_DROPPED): sensor.sensor_schema(
+                icon=ICON_COUNTER,
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_TOTAL_INCREASING,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
         }
     )
     .extend(MEASUREMENTS)
+    .extend(DIAGNOSTICS)
     .extend(cv.COMPONENT_SCHEMA).extend()
 )
 
 
 async def to_code(config):
     var = await cg.get_variable(config[CONF_MedisanaBS444_ID])
-    for x in range(1, 8):
+    if CONF_MISSED_SESSIONS in config:
+        sens = await sensor.new_sensor(config[CONF_MISSED_SESSIONS])
+        cg.add(var.set_missed_sessions(sens))
+    if CONF_CONNECTION_INTERVAL in config:
+        sens = await sensor.new_sensor(config[CONF_CONNECTION_INTERVAL])
+        cg.add(var.set_connection_interval_sensor(sens))
+    if CONF_MTU in config:
+        sens = await sensor.new_sensor(config[CONF_MTU])
+        cg.add(var.set_mtu_sensor(sens))
+    if CONF_FORWARD_QUEUE in config:
+        sens = await sensor.new_sensor(config[CONF_FORWARD_QUEUE])
+        cg.add(var.set_forward_queue_sensor(sens))
+    if CONF_FORWARD_DROPPED in config:
+        sens = await sensor.new_sensor(config[CONF_FORWARD_DROPPED])
+        cg.add(var.set_forward_dropped_sensor(sens))
+    for conf, phase in PHASES.items():
+        if conf in config:
+            sens = await sensor.new_sensor(config[conf])
+            cg.add(var.set_phase_sensor(phase, sens))
+    for conf, counter in COUNTERS.items():
+        if conf in config:
+            sens = await sensor.new_sensor(config[conf])
+            cg.add(var.set_counter_sensor(counter, sens))
+    for conf, (load, _, _) in LOADS.items():
+        if conf in config:
+            sens = await sensor.new_sensor(config[conf])
+            cg.add(var.set_load_sensor(load, sens))
+    for x in range(1, MAX_PERSONS + 1):
         CONF_VAL = "%s_%s" %(CONF_WEIGHT,x)
         if CONF_VAL in config:
             sens = await sensor.new_sensor(config[CONF_VAL])
@@ -147,3 +323,27 @@ async def to_code(config):
         if CONF_VAL in config:
             sens = await sensor.new_sensor(config[CONF_VAL])
             cg.add(var.set_size(x-1, sens))
+        CONF_VAL = "%s_%s" %(CONF_WEIGHT_7D,x)
+        if CONF_VAL in config:
+            sens = await sensor.new_sensor(config[CONF_VAL])
+            cg.add(var.set_weight_7d(x-1, sens))
+        CONF_VAL = "%s_%s" %(CONF_WEIGHT_30D,x)
+        if CONF_VAL in config:
+            sens = await sensor.new_sensor(config[CONF_VAL])
+            cg.add(var.set_weight_30d(x-1, sens))
+        CONF_VAL = "%s_%s" %(CONF_WEIGHT_WEEKLY,x)
+        if CONF_VAL in config:
+            sens = await sensor.new_sensor(config[CONF_VAL])
+            cg.add(var.set_weight_weekly(x-1, sens))
+        CONF_VAL = "%s_%s" %(CONF_FAT_7D,x)
+        if CONF_VAL in config:
+            sens = await sensor.new_sensor(config[CONF_VAL])
+            cg.add(var.set_fat_7d(x-1, sens))
+        CONF_VAL = "%s_%s" %(CONF_FAT_MASS,x)
+        if CONF_VAL in config:
+            sens = await sensor.new_sensor(config[CONF_VAL])
+            cg.add(var.set_fat_mass(x-1, sens))
+        CONF_VAL = "%s_%s" %(CONF_LEAN_MASS,x)
+        if CONF_VAL in config:
+            sens = await sensor.new_sensor(config[CONF_VAL])
+            cg.add(var.set_lean_mass(x-1, sens))
@@ -0,0 +1,108 @@
+// Decodes the sample packets of the medisanabs444.h header comment, checks
+// the values and reports decode and format throughput and the heap
+// allocations per record.
+//
+//   decode_bench [iterations]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include "History.h"
+#include "Protocol.h"
+
+using namespace esphome::medisana_bs444;
+
+static size_t allocations = 0;
+
+void *operator new(size_t size)
+{
+  allocations++;
+  if (void *p = malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+// handle=0x25, 0x1b and 0x1e of the header comment
+static const uint8_t PERSON[] = {0x84, 0x53, 0x02, 0x80, 0x01, 0x34, 0xb6, 0xe0, 0x00, 0x00,
+                                 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+static const uint8_t WEIGHT[] = {0x1d, 0x8c, 0x1e, 0x00, 0xfe, 0x6e, 0x0a, 0xa0, 0x56, 0x45,
+                                 0x11, 0x00, 0xff, 0x02, 0x09, 0x00, 0x00, 0x00, 0x00};
+static const uint8_t BODY[] = {0x6f, 0x6e, 0x0a, 0xa0, 0x56, 0x02, 0x44, 0x0a, 0xb8, 0xf0,
+                               0x7f, 0xf2, 0x6b, 0xf1, 0x1e, 0xf0, 0x00, 0x00, 0x00};
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+  if (!ok)
+  {
+    fprintf(stderr, "FAIL: %s\n", what);
+    failures++;
+  }
+}
+
+template <typename F>
+static void measure(const char *name, long iterations, F &&f)
+{
+  const size_t before = allocations;
+  const auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < iterations; i++)
+    f();
+  const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  printf("%-14s %8.1f ns/record %10.0f records/s %6.2f allocations/record\n", name, elapsed.count() / iterations,
+         iterations / elapsed.count() * 1e9, double(allocations - before) / iterations);
+}
+
+int main(int argc, char **argv)
+{
+  const long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+  const std::span<const uint8_t> person(PERSON), weight(WEIGHT), body(BODY);
+
+  // regression: the values of the samples
+  const auto p = Person::decode<BS444>(person);
+  check(p.valid && p.person == 2 && p.male && p.age == 52 && p.size == 182 && !p.highActivity, "person");
+  const auto w = Weight::decode<BS444>(weight);
+  check(w.valid && w.person == 2 && w.weight == 7820 && w.timestamp == time_t(0x56a00a6e) + BS444::EPOCH, "weight");
+  const auto b = Body::decode<BS444>(body);
+  check(b.valid && b.person == 2 && b.kcal == 2628 && b.fat == 184 && b.tbw == 639 && b.muscle == 363 && b.bone == 30,
+        "body");
+  check(b.timestamp == w.timestamp, "body timestamp");
+  check(bmi(w.weight, p.size) == 236, "bmi");
+  check(!Weight::decode<BS444>(weight.first(13)).valid, "short weight packet");
+  check(Weight::decode<BS440>(weight).timestamp == time_t(0x56a00a6e), "BS440 epoch");
+
+  // throughput, the volatile sink keeps the decoders from being optimised away
+  volatile uint32_t sink = 0;
+  measure("decode person", iterations, [&]
+          { sink = sink + Person::decode<BS444>(person).age; });
+  measure("decode weight", iterations, [&]
+          { sink = sink + Weight::decode<BS444>(weight).weight; });
+  measure("decode body", iterations, [&]
+          { sink = sink + Body::decode<BS444>(body).fat; });
+
+  char buffer[FORMAT_BUFFER_SIZE];
+  TimeFormatter time;
+  measure("format person", iterations, [&]
+          { sink = sink + p.format(buffer, sizeof(buffer))[0]; });
+  measure("format weight", iterations, [&]
+          { sink = sink + w.format(buffer, sizeof(buffer), time, p)[0]; });
+  measure("format body", iterations, [&]
+          { sink = sink + b.format(buffer, sizeof(buffer), time)[0]; });
+
+  UserHistory history;
+  uint32_t n = 0;
+  measure("history add", iterations, [&]
+          {
+            Weight next = w;
+            next.timestamp += n++ % 1000;
+            history.add(next); });
+
+  if (failures)
+    return 1;
+  printf("all sample packets decode to the known values\n");
+  return 0;
+}
@@ -0,0 +1,309 @@
+// Replays a session recorded with `capture: true`: walks the GATTC events of
+// the log, queues the indications like the BLE callback does and drains them
+// through HistorySync like loop() does. Prints the events, the measurements
+// handed out, the phases of the session and the host CPU time.
+//
+//   replay [-m BS410|BS430|BS440|BS444] [-v] [log]
+//
+// The log is the device log (or just its `capture N: ...` lines), read from
+// stdin when no file is given.
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "History.h"
+#include "HistorySync.h"
+#include "PacketRing.h"
+#include "Protocol.h"
+#include "SessionCapture.h"
+#include "SessionStats.h"
+
+using namespace esphome::medisana_bs444;
+
+static const char *event_name(uint8_t event)
+{
+  using G = SessionCapture::Gattc;
+  switch (event)
+  {
+  case G::OPEN:
+    return "open";
+  case G::READ_CHAR:
+    return "read";
+  case G::WRITE_CHAR:
+    return "write";
+  case G::SEARCH_CMPL:
+    return "search complete";
+  case G::WRITE_DESCR:
+    return "write descriptor";
+  case G::NOTIFY:
+    return "notify";
+  case G::CFG_MTU:
+    return "mtu";
+  case G::REG_FOR_NOTIFY:
+    return "register";
+  case G::DISCONNECT:
+    return "disconnect";
+  default:
+    return "?";
+  }
+}
+
+static int base64_value(char c)
+{
+  if (c >= 'A' && c <= 'Z')
+    return c - 'A';
+  if (c >= 'a' && c <= 'z')
+    return c - 'a' + 26;
+  if (c >= '0' && c <= '9')
+    return c - '0' + 52;
+  if (c == '+')
+    return 62;
+  if (c == '/')
+    return 63;
+  return -1;
+}
+
+static void base64_decode(const std::string &text, std::vector<uint8_t> &out)
+{
+  uint32_t bits = 0;
+  int count = 0;
+  for (char c : text)
+  {
+    const int value = base64_value(c);
+    if (value < 0)
+      break; // padding or the end of the line
+    bits = (bits << 6) | value;
+    count += 6;
+    if (count >= 8)
+    {
+      count -= 8;
+      out.push_back(uint8_t(bits >> count));
+    }
+  }
+}
+
+// the binary log of the `capture N: ...` lines, in the order they were logged
+static std::vector<uint8_t> read_capture(std::istream &in)
+{
+  std::vector<uint8_t> log;
+  std::string line;
+  while (std::getline(in, line))
+  {
+    const auto at = line.find("capture ");
+    if (at == std::string::npos)
+      continue;
+    unsigned chunk;
+    int used = 0;
+    if (sscanf(line.c_str() + at, "capture %u: %n", &chunk, &used) != 1 || used == 0)
+      continue; // the "capture of N bytes" line
+    base64_decode(line.substr(at + used), log);
+  }
+  return log;
+}
+
+template <typename Model>
+static int replay(const std::vector<uint8_t> &log, bool verbose)
+{
+  using Result = typename HistorySync<Model>::Result;
+  PacketRing<64> queue;
+  HistorySync<Model> sync;
+  SessionStats stats;
+  TimeFormatter time;
+  char buffer[FORMAT_BUFFER_SIZE];
+  // the node's clock, a recorded session lies in the past
+  const time_t now_s = std::time(nullptr);
+  size_t records = 0, measurements = 0;
+  std::chrono::nanoseconds cpu{0};
+
+  // like loop(): decode in batches, hand out the new records at the end of the session
+  auto drain = [&]()
+  {
+    for (auto batch = queue.batch(); !batch.empty(); batch = queue.batch())
+    {
+      for (const auto &packet : batch)
+      {
+        switch (packet.kind)
+        {
+        case Packet::SESSION_START:
+          stats.start();
+          sync.start();
+          break;
+        case Packet::PERSON:
+          sync.person(packet.payload());
+          break;
+        case Packet::WEIGHT:
+        case Packet::BODY:
+        {
+          records++;
+          stats.count(SessionStats::RECORDS);
+          Weight weight;
+          Body body;
+          const Result result = packet.kind == Packet::WEIGHT ? sync.add(packet.payload(), now_s, weight)
+                                                              : sync.add(packet.payload(), now_s, body);
+          if ((result == Result::SYNCED) || (result == Result::DUPLICATE))
+            stats.count(SessionStats::DUPLICATES);
+          else if (result == Result::FUTURE)
+            stats.count(SessionStats::FUTURE);
+          break;
+        }
+        case Packet::SESSION_END:
+        {
+          const uint8_t person = sync.person().person;
+          sync.hand_out([&](const Measurement &m)
+                        {
+                          printf("person %u: %s\n", person, m.format(buffer, sizeof(buffer), time));
+                          measurements++;
+                          return true; });
+          break;
+        }
+        }
+      }
+      queue.pop(batch.size());
+    }
+  };
+
+  using G = SessionCapture::Gattc;
+  SessionCapture::Event event;
+  size_t offset = 0;
+  uint32_t now = 0;
+  // SessionSetup::enabled(): the three registrations and the three CCCD
+  // writes are confirmed; the command write is a descriptor write as well
+  std::set<uint16_t> registered, enabled;
+  while (SessionCapture::next(log.data(), log.size(), offset, event))
+  {
+    now += event.delta;
+    if (verbose)
+      printf("%6u ms  %-16s status %3u handle 0x%04x %3u bytes\n", (unsigned)now, event_name(event.event),
+             event.status, event.handle, event.len);
+    const auto start = std::chrono::steady_clock::now();
+    switch (event.event)
+    {
+    case G::OPEN:
+      stats.opened(now);
+      queue.push(Packet::SESSION_START);
+      registered.clear();
+      enabled.clear();
+      break;
+    case G::SEARCH_CMPL:
+      stats.mark(SessionStats::DISCOVERY, now);
+      break;
+    case G::REG_FOR_NOTIFY:
+      if (event.status == 0)
+        registered.insert(event.handle);
+      break;
+    case G::WRITE_DESCR:
+      // the CCCD follows its characteristic
+      if ((event.status == 0) && registered.count(event.handle - 1))
+        enabled.insert(event.handle);
+      if ((registered.size() == 3) && (enabled.size() == 3))
+        stats.mark(SessionStats::REGISTERED, now);
+      break;
+    case G::NOTIFY:
+    {
+      // the log has the handles but not their characteristics, the validity
+      // byte of the packet tells them apart
+      const std::span<const uint8_t> payload(event.data, event.len);
+      Packet::Kind kind;
+      if (PersonView<Model>(payload).ok())
+        kind = Packet::PERSON;
+      else if (WeightView<Model>(payload).ok())
+        kind = Packet::WEIGHT;
+      else if (BodyView<Model>(payload).ok())
+        kind = Packet::BODY;
+      else
+      {
+        printf("%6u ms  unknown indication on handle 0x%04x\n", (unsigned)now, event.handle);
+        break;
+      }
+      stats.mark(SessionStats::FIRST_INDICATION, now);
+      stats.mark(SessionStats::LAST_INDICATION, now);
+      queue.push(kind, event.data, event.len);
+      break;
+    }
+    case G::DISCONNECT:
+      stats.mark(SessionStats::DISCONNECT, now);
+      queue.push(Packet::SESSION_END);
+      break;
+    default:
+      break;
+    }
+    drain();
+    cpu += std::chrono::steady_clock::now() - start;
+  }
+  if (offset != log.size())
+    fprintf(stderr, "corrupt record at byte %zu of %zu\n", offset, log.size());
+  stats.finish(now);
+
+  printf("session: discovery %u ms, registered %u ms, indications %u..%u ms, disconnect %u ms\n",
+         (unsigned)stats.last(SessionStats::DISCOVERY), (unsigned)stats.last(SessionStats::REGISTERED),
+         (unsigned)stats.last(SessionStats::FIRST_INDICATION), (unsigned)stats.last(SessionStats::LAST_INDICATION),
+         (unsigned)stats.last(SessionStats::DISCONNECT));
+  printf("session: %zu records, %u duplicates, %u future, %zu measurements, %.1f us host cpu\n", records,
+         (unsigned)stats.last(SessionStats::DUPLICATES), (unsigned)stats.last(SessionStats::FUTURE), measurements,
+         cpu.count() / 1000.0);
+  return (offset == log.size() && measurements > 0) ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+  ScaleModel model = ScaleModel::BS444;
+  bool verbose = false;
+  const char *file = nullptr;
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-v"))
+      verbose = true;
+    else if (!strcmp(argv[i], "-m") && i + 1 < argc)
+    {
+      const char *name = argv[++i];
+      if (!strcmp(name, "BS410"))
+        model = ScaleModel::BS410;
+      else if (!strcmp(name, "BS430"))
+        model = ScaleModel::BS430;
+      else if (!strcmp(name, "BS440"))
+        model = ScaleModel::BS440;
+      else if (strcmp(name, "BS444"))
+      {
+        fprintf(stderr, "unknown model %s\n", name);
+        return 2;
+      }
+    }
+    else
+      file = argv[i];
+  }
+
+  std::vector<uint8_t> log;
+  if (file)
+  {
+    std::ifstream in(file);
+    if (!in)
+    {
+      fprintf(stderr, "can not open %s\n", file);
+      return 2;
+    }
+    log = read_capture(in);
+  }
+  else
+    log = read_capture(std::cin);
+  printf("capture of %zu bytes\n", log.size());
+
+  switch (model)
+  {
+  case ScaleModel::BS410:
+    return replay<ModelTraits<ScaleModel::BS410>::Protocol>(log, verbose);
+  case ScaleModel::BS430:
+    return replay<ModelTraits<ScaleModel::BS430>::Protocol>(log, verbose);
+  case ScaleModel::BS440:
+    return replay<ModelTraits<ScaleModel::BS440>::Protocol>(log, verbose);
+  case ScaleModel::BS444:
+  default:
+    return replay<ModelTraits<ScaleModel::BS444>::Protocol>(log, verbose);
+  }
+}
@@ -0,0 +1,727 @@
+// Simulates a node serving several scales, to size how many scales one node
+// can handle. Time is simulated in steps of 1 ms, the CPU time and the heap are
+// measured for real on the host.
+//
+// A simulated scale answers like the BS444's GATT server: a table with the
+// person, weight, body and command characteristics, registrations and CCCD
+// writes that are confirmed one connection event later, and a command write
+// that sets its clock and starts the dump of the person that just weighed in:
+// the person packet, then weight and body of every record it keeps, one
+// indication per connection event.
+//
+// The node is the component's own code without ESPHome or ESP-IDF, called in
+// the order the BLE callback and loop() of MedisanaBS444 call it: the session
+// scheduler, SessionSetup, the PacketRing, HistorySync (decoding, watermarks,
+// history, hand out) and SessionStats. This file stands in for the BLE client
+// and the ESPHome parts: the GATT requests, the idle timer that ends a dump
+// which is not complete, and the Publisher's few states per loop().
+//
+//   session_sim [-s scales] [-u users] [-r records] [-n rounds] [-i interval_ms]
+//               [-m max_sessions] [-k skew_s] [-d duplicate_%] [-f future_%] [-c]
+//               [-w capture_file]
+//
+// -c checks the results and fails when a weigh-in was lost, rejected or handed
+// out twice. -w records the first session of the first scale with
+// SessionCapture and writes it the way `capture: true` logs it, for replay.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <new>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "History.h"
+#include "HistorySync.h"
+#include "PacketRing.h"
+#include "Protocol.h"
+#include "SessionCapture.h"
+#include "SessionScheduler.h"
+#include "SessionSetup.h"
+#include "SessionStats.h"
+
+using namespace esphome::medisana_bs444;
+using Model = BS444;
+
+// live heap of the process, the peak is what the node would need
+static size_t heap_live = 0, heap_peak = 0;
+
+void *operator new(size_t size)
+{
+  auto *p = static_cast<size_t *>(malloc(size + sizeof(size_t)));
+  if (p == nullptr)
+    throw std::bad_alloc();
+  *p = size;
+  heap_live += size;
+  heap_peak = std::max(heap_peak, heap_live);
+  return p + 1;
+}
+void operator delete(void *p) noexcept
+{
+  if (p == nullptr)
+    return;
+  auto *block = static_cast<size_t *>(p) - 1;
+  heap_live -= *block;
+  free(block);
+}
+void operator delete(void *p, size_t) noexcept { operator delete(p); }
+
+struct Options
+{
+  int scales = 1;
+  int users = 1;
+  int records = HISTORY_SIZE;
+  int rounds = 4;
+  uint32_t interval = 15;   // ms between connection events
+  int max_sessions = 3;
+  int skew = 0;             // s, the clocks of the scales are off by up to this
+  int duplicates = 0;       // % of the indications sent twice
+  int future = 0;           // % of the records with a time in the future
+  bool check = false;
+  const char *write = nullptr; // capture file
+};
+
+// the disconnect reason of end_session_(), ESP_GATT_CONN_TERMINATE_LOCAL_HOST
+static constexpr uint8_t LOCAL_HOST = 0x16;
+
+// the BS444 keeps its clock from the last command, unix time at node start
+static constexpr time_t START = 1700000000;
+// how long the scale advertises after a weigh-in, and the time between rounds
+static constexpr uint32_t AWAKE = 20000;
+static constexpr uint32_t ROUND = 60000;
+// link and node timings of ESP-IDF and ESPHome
+static constexpr uint32_t ADVERTISING_INTERVAL = 100;
+static constexpr uint32_t CONNECT_TIME = 50;
+static constexpr uint32_t DISCOVERY_TIME = 400;
+static constexpr uint32_t LOOP_INTERVAL = 16;
+static constexpr uint32_t IDLE_TIMEOUT = 2000;
+static constexpr size_t PER_LOOP = 2;
+// states of a person per session: weight, bmi, body values, profile
+static constexpr size_t STATES_PER_SESSION = 12;
+
+static void le16(uint8_t *p, uint16_t value)
+{
+  p[0] = value & 0xff;
+  p[1] = value >> 8;
+}
+static void le32(uint8_t *p, uint32_t value)
+{
+  le16(p, value & 0xffff);
+  le16(p + 2, value >> 16);
+}
+
+// base64 like esphome::base64_encode()
+static std::string base64(const uint8_t *data, size_t len)
+{
+  static const char *const ALPHABET = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  for (size_t i = 0; i < len; i += 3)
+  {
+    const uint32_t bits = (data[i] << 16) | ((i + 1 < len ? data[i + 1] : 0) << 8) | (i + 2 < len ? data[i + 2] : 0);
+    out += ALPHABET[(bits >> 18) & 0x3f];
+    out += ALPHABET[(bits >> 12) & 0x3f];
+    out += i + 1 < len ? ALPHABET[(bits >> 6) & 0x3f] : '=';
+    out += i + 2 < len ? ALPHABET[bits & 0x3f] : '=';
+  }
+  return out;
+}
+
+// the log lines of dump_capture_(), without the logger's prefix
+static bool write_capture(const char *file, const SessionCapture &capture)
+{
+  static constexpr size_t CHUNK = 96;
+  std::ofstream out(file);
+  out << "capture of " << capture.size() << " bytes" << (capture.truncated() ? " (truncated)" : "") << "\n";
+  for (size_t offset = 0; offset < capture.size(); offset += CHUNK)
+    out << "capture " << offset / CHUNK << ": "
+        << base64(capture.data() + offset, std::min(CHUNK, capture.size() - offset)) << "\n";
+  return bool(out);
+}
+
+struct Record
+{
+  uint32_t timestamp; // unix
+  uint16_t weight;
+  uint16_t fat;
+  bool future; // a clock error of the scale, the node rejects it
+};
+
+// One scale: its GATT table, the persons' histories and the dump.
+class SimScale
+{
+public:
+  static constexpr uint16_t PERSON = 0x25, WEIGHT = 0x1b, BODY = 0x1e, COMMAND = 0x21;
+
+  struct Characteristic
+  {
+    const Uuid128 *uuid;
+    uint16_t handle;
+  };
+  static constexpr Characteristic TABLE[] = {
+      {&Model::CHAR_PERSON, PERSON},
+      {&Model::CHAR_WEIGHT, WEIGHT},
+      {&Model::CHAR_BODY, BODY},
+      {&Model::CHAR_COMMAND, COMMAND},
+  };
+
+  SimScale(const Options &options, int skew, std::mt19937 &random)
+      : options_(options), skew_(skew), random_(random), histories_(options.users), records_(options.users)
+  {
+  }
+
+  // a person steps on the scale, the records before it are in its history already
+  void weigh_in(uint8_t person, time_t now)
+  {
+    auto &history = histories_[person - 1];
+    if (history.empty())
+    {
+      for (int i = options_.records - 1; i > 0; i--)
+      {
+        history.push_back(this->record_(now - i * 86400));
+        records_[person - 1].push_back(history.back());
+      }
+    }
+    history.push_back(this->record_(now));
+    records_[person - 1].push_back(history.back());
+    while (history.size() > HISTORY_SIZE)
+      history.pop_front();
+    person_ = person;
+    dump_.clear();
+    enabled_ = 0;
+  }
+
+  // GATT requests, the status of the confirmation
+  bool register_for_notify(uint16_t handle) { return (handle == PERSON) || (handle == WEIGHT) || (handle == BODY); }
+  bool write_descr(uint16_t handle, const uint8_t *data, size_t len)
+  {
+    if ((handle == PERSON + 1) || (handle == WEIGHT + 1) || (handle == BODY + 1))
+    {
+      enabled_++;
+      return true;
+    }
+    if ((handle != COMMAND) || (len != 5) || (data[0] != 2) || (enabled_ < 3))
+      return false;
+    this->start_dump_();
+    return true;
+  }
+
+  // the next indication, false when the dump is over
+  bool indication(uint16_t &handle, std::vector<uint8_t> &value)
+  {
+    if (dump_.empty())
+      return false;
+    handle = dump_.front().first;
+    value = dump_.front().second;
+    dump_.pop_front();
+    return true;
+  }
+
+  // every record the person ever made, also the ones the scale dropped since
+  const std::vector<Record> &records(uint8_t person) const { return records_[person - 1]; }
+
+private:
+  Record record_(time_t time)
+  {
+    std::uniform_int_distribution<int> percent(0, 99), weight(6000, 9000), fat(150, 300);
+    Record record{uint32_t(time + skew_), uint16_t(weight(random_)), uint16_t(fat(random_)), false};
+    // a year ahead, clear of the other records
+    if (percent(random_) < options_.future)
+    {
+      record.timestamp += 365 * 86400;
+      record.future = true;
+    }
+    return record;
+  }
+
+  void send_(uint16_t handle, std::vector<uint8_t> value)
+  {
+    std::uniform_int_distribution<int> percent(0, 99);
+    if (handle != PERSON && percent(random_) < options_.duplicates)
+      dump_.emplace_back(handle, value);
+    dump_.emplace_back(handle, std::move(value));
+  }
+
+  void start_dump_()
+  {
+    std::vector<uint8_t> person(20, 0);
+    person[0] = Model::PERSON_VALID;
+    person[Model::PERSON_PERSON] = person_;
+    person[Model::PERSON_GENDER] = person_ & 1;
+    person[Model::PERSON_AGE] = 30 + person_;
+    person[Model::PERSON_SIZE] = 170 + person_;
+    this->send_(PERSON, person);
+    for (const auto &record : histories_[person_ - 1])
+    {
+      const uint32_t time = record.timestamp - Model::EPOCH;
+      std::vector<uint8_t> weight(19, 0);
+      weight[0] = Model::WEIGHT_VALID;
+      le16(&weight[Model::WEIGHT_WEIGHT], record.weight);
+      le32(&weight[Model::WEIGHT_TIME], time);
+      weight[Model::WEIGHT_PERSON] = person_;
+      this->send_(WEIGHT, weight);
+      std::vector<uint8_t> body(19, 0);
+      body[0] = Model::BODY_VALID;
+      le32(&body[Model::BODY_TIME], time);
+      body[Model::BODY_PERSON] = person_;
+      le16(&body[Model::BODY_KCAL], 2000 + record.fat);
+      le16(&body[Model::BODY_FAT], 0xf000 | record.fat);
+      le16(&body[Model::BODY_TBW], 0xf000 | 550);
+      le16(&body[Model::BODY_MUSCLE], 0xf000 | 350);
+      le16(&body[Model::BODY_BONE], 0xf000 | 30);
+      this->send_(BODY, body);
+    }
+  }
+
+  const Options &options_;
+  const int skew_;
+  std::mt19937 &random_;
+  std::vector<std::deque<Record>> histories_;
+  std::vector<std::vector<Record>> records_;
+  std::deque<std::pair<uint16_t, std::vector<uint8_t>>> dump_;
+  uint8_t person_ = 0;
+  int enabled_ = 0;
+};
+
+// The node side of one scale, what the component keeps per scale.
+struct NodeScale
+{
+  enum class Link : uint8_t
+  {
+    IDLE,
+    CONNECTING,
+    DISCOVERING,
+    CONNECTED,
+  };
+
+  std::unique_ptr<SimScale> scale;
+  uint8_t scheduler_id = 0;
+  Link link = Link::IDLE;
+  uint32_t link_at = 0; // when the connection opens or discovery completes
+  uint32_t woke = 0;
+  uint32_t asleep = 0;
+  bool handles_cached = false;
+  uint16_t person = 0, weight = 0, body = 0, command = 0;
+  SessionSetup setup;
+  // confirmations on their way back, one per connection event
+  std::deque<std::pair<bool, std::pair<uint16_t, bool>>> confirmations;
+  PacketRing<64> queue;
+  HistorySync<Model> sync;
+  SessionStats stats;
+  uint32_t last_indication = 0;
+  bool complete = false;
+  bool ending = false;
+  size_t states = 0; // waiting in the publisher
+  uint32_t session_end = 0;
+  bool publishing = false;
+  // handed out per person, to check that no weigh-in is lost or repeated
+  std::set<uint32_t> handed_out[MAX_PERSONS];
+  size_t duplicate_hand_outs = 0;
+  // the session being recorded for -w, like capture_event_()
+  std::unique_ptr<SessionCapture> capture;
+  bool capturing = false;
+
+  void record(uint8_t event, uint8_t status, uint16_t handle, uint32_t now, const uint8_t *data = nullptr,
+              size_t len = 0)
+  {
+    if (capturing)
+      capture->record(event, status, handle, data, len, now);
+  }
+};
+
+struct Summary
+{
+  uint64_t sum = 0;
+  uint32_t max = 0;
+  uint32_t count = 0;
+
+  void add(uint32_t value)
+  {
+    sum += value;
+    max = std::max(max, value);
+    count++;
+  }
+  double avg() const { return count ? double(sum) / count : 0; }
+};
+
+int main(int argc, char **argv)
+{
+  Options options;
+  for (int i = 1; i + 1 < argc || (i < argc && !strcmp(argv[i], "-c")); i++)
+  {
+    const char *option = argv[i];
+    if (!strcmp(option, "-c"))
+    {
+      options.check = true;
+      continue;
+    }
+    if (!strcmp(option, "-w"))
+    {
+      options.write = argv[++i];
+      continue;
+    }
+    const int value = atoi(argv[++i]);
+    if (!strcmp(option, "-s"))
+      options.scales = std::max(1, value);
+    else if (!strcmp(option, "-u"))
+      options.users = std::clamp(value, 1, int(MAX_PERSONS));
+    else if (!strcmp(option, "-r"))
+      options.records = std::clamp(value, 1, int(HISTORY_SIZE));
+    else if (!strcmp(option, "-n"))
+      options.rounds = std::max(1, value);
+    else if (!strcmp(option, "-i"))
+      options.interval = std::max(8, value);
+    else if (!strcmp(option, "-m"))
+      options.max_sessions = std::max(1, value);
+    else if (!strcmp(option, "-k"))
+      options.skew = std::max(0, value);
+    else if (!strcmp(option, "-d"))
+      options.duplicates = std::clamp(value, 0, 100);
+    else if (!strcmp(option, "-f"))
+      options.future = std::clamp(value, 0, 100);
+  }
+
+  std::mt19937 random(1);
+  auto &scheduler = SessionScheduler::instance();
+  scheduler.set_max_sessions(options.max_sessions);
+  const size_t heap_before = heap_live;
+  std::vector<NodeScale> nodes(options.scales);
+  for (int i = 0; i < options.scales; i++)
+  {
+    // half the scales run ahead, half behind
+    const int skew = (i % 2 ? 1 : -1) * options.skew;
+    nodes[i].scale.reset(new SimScale(options, skew, random));
+    nodes[i].scheduler_id = scheduler.add_scale();
+  }
+  if (options.write)
+    nodes[0].capture.reset(new SessionCapture());
+
+  Summary event_cpu, session_cpu, wait, latency, publish;
+  uint32_t sessions = 0, setup_failures = 0;
+  uint64_t records = 0, duplicates = 0, future = 0, rejected = 0;
+  auto node_now = [](uint32_t t)
+  { return START + time_t(t / 1000); };
+  // the CPU time of one call into the node
+  auto timed = [&](NodeScale &node, auto &&f)
+  {
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    const uint32_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    event_cpu.add(ns);
+    node.stats.cpu(ns / 1000);
+  };
+
+  // like loop(): resend setup steps, drain the queue, publish a few states
+  auto loop = [&](NodeScale &node, SimScale &scale, uint32_t t)
+  {
+    while (auto action = node.setup.next(t))
+    {
+      bool ok = false;
+      if (action.kind == SessionSetup::Action::REGISTER)
+        ok = scale.register_for_notify(action.handle);
+      else
+      {
+        uint8_t data[5] = {2, 0, 0, 0, 0};
+        if (action.kind == SessionSetup::Action::WRITE_COMMAND)
+        {
+          const uint32_t time = node_now(t) - Model::EPOCH;
+          memcpy(&data[1], &time, 4);
+          ok = scale.write_descr(action.handle, data, 5);
+        }
+        else
+          ok = scale.write_descr(action.handle, data, 2);
+      }
+      node.confirmations.push_back({action.kind == SessionSetup::Action::REGISTER, {action.handle, ok}});
+    }
+    if (node.setup.enabled())
+      node.stats.mark(SessionStats::REGISTERED, t);
+    if (node.setup.state() == SessionSetup::State::FAILED)
+    {
+      setup_failures++;
+      node.setup.stop();
+      node.ending = true;
+    }
+
+    for (auto batch = node.queue.batch(); !batch.empty(); batch = node.queue.batch())
+    {
+      for (const auto &packet : batch)
+      {
+        switch (packet.kind)
+        {
+        case Packet::SESSION_START:
+          node.stats.start();
+          node.sync.start();
+          break;
+        case Packet::PERSON:
+          node.sync.person(packet.payload());
+          break;
+        case Packet::WEIGHT:
+        case Packet::BODY:
+        {
+          node.stats.count(SessionStats::RECORDS);
+          records++;
+          Weight weight;
+          Body body;
+          const auto result = packet.kind == Packet::WEIGHT ? node.sync.add(packet.payload(), node_now(t), weight)
+                                                            : node.sync.add(packet.payload(), node_now(t), body);
+          switch (result)
+          {
+          case HistorySync<Model>::Result::SYNCED:
+          case HistorySync<Model>::Result::DUPLICATE:
+            node.stats.count(SessionStats::DUPLICATES);
+            duplicates++;
+            break;
+          case HistorySync<Model>::Result::FUTURE:
+          {
+            node.stats.count(SessionStats::FUTURE);
+            future++;
+            // only the scale's clock errors may be rejected, not a weigh-in
+            const auto key = packet.kind == Packet::WEIGHT ? WeightView<Model>(packet.payload()).key()
+                                                           : BodyView<Model>(packet.payload()).key();
+            if (key.timestamp + Model::EPOCH < node_now(t) + 86400)
+              rejected++;
+            break;
+          }
+          default:
+            break;
+          }
+          break;
+        }
+        case Packet::SESSION_END:
+        {
+          // publish_session_(): hand out the new records, the watermark advances
+          const uint8_t person = node.sync.person().person;
+          if (node.sync.hand_out([&](const Measurement &measurement)
+                                 {
+                                   if (!node.handed_out[person - 1].insert(measurement.timestamp).second)
+                                     node.duplicate_hand_outs++;
+                                   return true; }))
+            node.states += STATES_PER_SESSION;
+          node.stats.finish(t);
+          session_cpu.add(node.stats.last(SessionStats::SESSION_CPU));
+          node.session_end = t;
+          node.publishing = true;
+          break;
+        }
+        }
+      }
+      node.queue.pop(batch.size());
+    }
+    // check_dump_complete_()
+    node.complete = node.sync.complete();
+
+    const size_t n = std::min(node.states, PER_LOOP);
+    node.states -= n;
+    if (node.publishing && (node.states == 0))
+    {
+      node.publishing = false;
+      publish.add(t - node.session_end);
+      node.stats.published(t);
+      latency.add(t - node.woke);
+    }
+  };
+
+  const uint32_t end = options.rounds * ROUND;
+  for (uint32_t t = 0; t < end + ROUND; t++)
+  {
+    for (auto &node : nodes)
+    {
+      auto &scale = *node.scale;
+      // every round a person of every scale weighs in, all at the same time
+      if ((t < end) && (t % ROUND == 0))
+      {
+        const uint8_t person = 1 + (t / ROUND + node.scheduler_id) % options.users;
+        scale.weigh_in(person, node_now(t));
+        node.woke = t;
+        node.asleep = t + AWAKE;
+      }
+
+      switch (node.link)
+      {
+      case NodeScale::Link::IDLE:
+        // parse_device() and schedule_(): the client connects on the advertisement when enabled
+        if ((t < node.asleep) && (t - node.woke) % ADVERTISING_INTERVAL == 0)
+        {
+          timed(node, [&]()
+                {
+                  scheduler.advertising(node.scheduler_id, t);
+                  node.stats.advertised(t);
+                  scheduler.update(t); });
+          if (scheduler.may_connect(node.scheduler_id))
+          {
+            node.link = NodeScale::Link::CONNECTING;
+            node.link_at = t + CONNECT_TIME;
+          }
+        }
+        else if ((t % 1000) == 0)
+          scheduler.update(t);
+        break;
+      case NodeScale::Link::CONNECTING:
+        if (t < node.link_at)
+          break;
+        // OPEN_EVT
+        timed(node, [&]()
+              {
+                scheduler.session_started(node.scheduler_id, t);
+                node.stats.opened(t);
+                node.queue.push(Packet::SESSION_START); });
+        if (node.capture && !node.capturing && node.capture->size() == 0)
+          node.capturing = true;
+        node.record(SessionCapture::OPEN, 0, 0, t);
+        wait.add(t - node.woke);
+        sessions++;
+        node.ending = false;
+        node.complete = false;
+        node.confirmations.clear();
+        node.link = node.handles_cached ? NodeScale::Link::CONNECTED : NodeScale::Link::DISCOVERING;
+        node.link_at = t + DISCOVERY_TIME;
+        if (node.handles_cached)
+          node.setup.start(node.person, node.weight, node.body, node.command);
+        break;
+      case NodeScale::Link::DISCOVERING:
+        if (t < node.link_at)
+          break;
+        // SEARCH_CMPL_EVT: find the characteristics by UUID like discover_handles_()
+        timed(node, [&]()
+              {
+                for (const auto &c : SimScale::TABLE)
+                {
+                  if (c.uuid == &Model::CHAR_PERSON)
+                    node.person = c.handle;
+                  else if (c.uuid == &Model::CHAR_WEIGHT)
+                    node.weight = c.handle;
+                  else if (c.uuid == &Model::CHAR_BODY)
+                    node.body = c.handle;
+                  else if (c.uuid == &Model::CHAR_COMMAND)
+                    node.command = c.handle;
+                }
+                node.stats.mark(SessionStats::DISCOVERY, t);
+                node.setup.start(node.person, node.weight, node.body, node.command); });
+        node.record(SessionCapture::SEARCH_CMPL, 0, 0, t);
+        node.handles_cached = true;
+        node.link = NodeScale::Link::CONNECTED;
+        break;
+      case NodeScale::Link::CONNECTED:
+      {
+        // end_session_(): complete history, idle or setup failed, then DISCONNECT_EVT
+        const bool idle = node.last_indication && (t - node.last_indication > IDLE_TIMEOUT);
+        if (node.ending || node.complete || idle)
+        {
+          timed(node, [&]()
+                {
+                  scheduler.session_ended(node.scheduler_id, t);
+                  node.stats.mark(SessionStats::DISCONNECT, t);
+                  node.setup.stop();
+                  node.queue.push(Packet::SESSION_END); });
+          node.record(SessionCapture::DISCONNECT, LOCAL_HOST, 0, t);
+          if (node.capturing)
+          {
+            // dump_capture_()
+            node.capturing = false;
+            if (!write_capture(options.write, *node.capture))
+              fprintf(stderr, "can not write %s\n", options.write);
+          }
+          node.link = NodeScale::Link::IDLE;
+          node.last_indication = 0;
+          node.complete = false;
+          node.asleep = t; // the scale goes back to sleep
+          break;
+        }
+        if (t % options.interval != 0)
+          break;
+        // a connection event: one confirmation or one indication
+        if (!node.confirmations.empty())
+        {
+          const auto confirmation = node.confirmations.front();
+          node.confirmations.pop_front();
+          timed(node, [&]()
+                {
+                  if (confirmation.first)
+                    node.setup.registered(confirmation.second.first, confirmation.second.second);
+                  else
+                    node.setup.written(confirmation.second.first, confirmation.second.second); });
+          // REG_FOR_NOTIFY_EVT, or WRITE_DESCR_EVT: the command goes out as a descriptor write too
+          node.record(confirmation.first ? SessionCapture::REG_FOR_NOTIFY : SessionCapture::WRITE_DESCR,
+                      confirmation.second.second ? 0 : 1, confirmation.second.first, t);
+          break;
+        }
+        uint16_t handle;
+        std::vector<uint8_t> value;
+        if (!scale.indication(handle, value))
+          break;
+        timed(node, [&]()
+              {
+                // NOTIFY_EVT: the handle tells the packets apart
+                const auto kind = handle == node.person ? Packet::PERSON : handle == node.weight ? Packet::WEIGHT : Packet::BODY;
+                node.queue.push(kind, value.data(), value.size());
+                node.stats.mark(SessionStats::FIRST_INDICATION, t);
+                node.stats.mark(SessionStats::LAST_INDICATION, t); });
+        node.record(SessionCapture::NOTIFY, 0, handle, t, value.data(), value.size());
+        node.last_indication = t;
+        break;
+      }
+      }
+
+      if (t % LOOP_INTERVAL == 0)
+        timed(node, [&]()
+              { loop(node, scale, t); });
+    }
+  }
+
+  // every weigh-in is handed out once, only the clock errors are not
+  size_t expected = 0, handed_out = 0, repeated = 0;
+  uint32_t missed = 0;
+  for (auto &node : nodes)
+  {
+    for (uint8_t person = 1; person <= options.users; person++)
+    {
+      const auto &dumped = node.handed_out[person - 1];
+      handed_out += dumped.size();
+      for (const auto &record : node.scale->records(person))
+      {
+        if (!record.future)
+          expected++;
+      }
+    }
+    repeated += node.duplicate_hand_outs;
+    missed += scheduler.missed(node.scheduler_id);
+  }
+
+  printf("%d scales, %d users, %d records, %d rounds, %u ms interval, %d sessions at once\n", options.scales,
+         options.users, options.records, options.rounds, options.interval, options.max_sessions);
+  printf("sessions       %6u done, %u missed, %u setup failures\n", sessions, missed, setup_failures);
+  printf("records        %6llu received, %llu duplicates, %llu future (%llu weigh-ins), %zu handed out\n",
+         (unsigned long long)records, (unsigned long long)duplicates, (unsigned long long)future,
+         (unsigned long long)rejected, handed_out);
+  printf("wait           %8.1f ms avg %6u ms max   weigh-in to connected\n", wait.avg(), wait.max);
+  printf("latency        %8.1f ms avg %6u ms max   weigh-in to the last state published\n", latency.avg(), latency.max);
+  printf("publish        %8.1f ms avg %6u ms max   session end to the last state published\n", publish.avg(),
+         publish.max);
+  printf("cpu per event  %8.1f us avg %6.1f us max   host\n", event_cpu.avg() / 1000, event_cpu.max / 1000.0);
+  printf("cpu per session%8.1f us avg %6u us max   host\n", session_cpu.avg(), session_cpu.max);
+  printf("heap           %8zu bytes peak, %zu per scale, the simulated scales included\n", heap_peak - heap_before,
+         (heap_peak - heap_before) / options.scales);
+
+  if (!options.check)
+    return 0;
+  bool ok = true;
+  if (setup_failures || repeated || rejected)
+  {
+    fprintf(stderr, "FAIL: %u setup failures, %zu measurements handed out twice, %llu weigh-ins rejected\n",
+            setup_failures, repeated, (unsigned long long)rejected);
+    ok = false;
+  }
+  // with a slot for every scale nothing is missed and every weigh-in makes it
+  if ((options.scales <= options.max_sessions) && (missed || (handed_out != expected)))
+  {
+    fprintf(stderr, "FAIL: %u missed sessions, %zu of %zu measurements handed out\n", missed, handed_out, expected);
+    ok = false;
+  }
+  return ok ? 0 : 1;
+}